@@ -0,0 +1,114 @@
+#include "tdigest.h"
+#include "tdigest_centroid.h"
+#include "tdigest_index.h"
+#include "tdigest_kernel.h"
+
+#include <cstdio>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+namespace{
+	constexpr double DELTA		= 0.05;
+	constexpr size_t QUERIES	= 1 << 20;
+	constexpr size_t PERCENTILES	= 1 << 12;	// linear scan is slow
+
+	using Centroid = RawTDigest::Centroid;
+
+	template<typename F>
+	auto measure(size_t count, F f){
+		auto const start = std::chrono::steady_clock::now();
+
+		size_t const checksum = f();
+
+		auto const end = std::chrono::steady_clock::now();
+
+		auto const ns = std::chrono::duration<double, std::nano>(end - start).count();
+
+		return std::pair{ ns / static_cast<double>(count), checksum };
+	}
+
+	void benchSearch(size_t const capacity, std::mt19937_64 &gen){
+		RawTDigest td{ capacity, DELTA };
+
+		std::vector<Centroid> cd(capacity);
+
+		std::uniform_real_distribution<double> dist(0, 1000);
+
+		std::vector<double> means(capacity);
+		for(auto &x : means)
+			x = dist(gen);
+
+		std::sort(std::begin(means), std::end(means));
+
+		for(size_t i = 0; i < capacity; ++i)
+			cd[i] = Centroid::create(means[i], 1 + gen() % 16);
+
+		std::vector<double> queries(QUERIES);
+		for(auto &x : queries)
+			x = dist(gen);
+
+		std::vector<double> pp(PERCENTILES);
+		for(auto &x : pp)
+			x = std::uniform_real_distribution<double>(0, 1)(gen);
+
+		TDigestIndex const index{ td, cd.data() };
+
+		auto const first = cd.data();
+		auto const last  = cd.data() + capacity;
+
+		auto [tStd, cStd] = measure(QUERIES, [&](){
+			size_t sum = 0;
+			for(auto const &q : queries)
+				sum += static_cast<size_t>(std::lower_bound(first, last, Centroid::create(q, 1)) - first);
+			return sum;
+		});
+
+		auto [tBl, cBl] = measure(QUERIES, [&](){
+			size_t sum = 0;
+			for(auto const &q : queries)
+				sum += static_cast<size_t>(lowerBoundBranchless(first, last, Centroid::create(q, 1)) - first);
+			return sum;
+		});
+
+		auto [tEyt, cEyt] = measure(QUERIES, [&](){
+			size_t sum = 0;
+			for(auto const &q : queries)
+				sum += index.lowerBound(q);
+			return sum;
+		});
+
+		auto [tPct, cPct] = measure(PERCENTILES, [&](){
+			double sum = 0;
+			for(auto const &p : pp)
+				sum += td.percentile(first, p);
+			return static_cast<size_t>(sum);
+		});
+
+		auto [tPctEyt, cPctEyt] = measure(PERCENTILES, [&](){
+			double sum = 0;
+			for(auto const &p : pp)
+				sum += index.percentile(p);
+			return static_cast<size_t>(sum);
+		});
+
+		printf("%8zu | %8.2f %8.2f %8.2f | %9.2f %9.2f | %s\n",
+				capacity,
+				tStd, tBl, tEyt,
+				tPct, tPctEyt,
+				cStd == cBl && cStd == cEyt && cPct == cPctEyt ? "ok" : "MISMATCH"
+		);
+	}
+} // anonymous namespace
+
+int main(){
+	std::mt19937_64 gen{ 42 };
+
+	printf("ns per query, scan kernel %s\n", tdigest_kernel::name());
+	printf("%8s | %8s %8s %8s | %9s %9s |\n", "capacity", "lower_b", "branchl", "eytz", "pct", "pct eytz");
+
+	for(size_t capacity = 64; capacity <= 65536; capacity *= 4)
+		benchSearch(capacity, gen);
+}
+
@@ -0,0 +1,46 @@
+#include "epoch.h"
+
+#include <limits>
+#include <algorithm>
+
+EpochDomain::~EpochDomain(){
+	for(auto const &r : retired_)
+		r.deleter(r.p);
+}
+
+size_t EpochDomain::acquireSlot(){
+	for(size_t i = 0; i < readers_; ++i){
+		bool expected = false;
+
+		if (slots_[i].used.compare_exchange_strong(expected, true, std::memory_order_acquire))
+			return i;
+	}
+
+	return NO_SLOT;
+}
+
+size_t EpochDomain::reclaim(){
+	uint64_t minEpoch = std::numeric_limits<uint64_t>::max();
+
+	for(size_t i = 0; i < readers_; ++i){
+		auto const e = slots_[i].epoch.load();
+
+		if (e)
+			minEpoch = std::min(minEpoch, e);
+	}
+
+	// reader pinned after the tag, loaded the new object
+	auto it = std::partition(std::begin(retired_), std::end(retired_), [minEpoch](Retired const &r){
+		return r.epoch >= minEpoch;
+	});
+
+	for(auto jt = it; jt != std::end(retired_); ++jt)
+		jt->deleter(jt->p);
+
+	auto const count = static_cast<size_t>(std::end(retired_) - it);
+
+	retired_.erase(it, std::end(retired_));
+
+	return count;
+}
+
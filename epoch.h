@@ -0,0 +1,72 @@
+#ifndef EPOCH_H_
+#define EPOCH_H_
+
+#include <cstdint>
+#include <atomic>
+#include <vector>
+#include <memory>
+
+// Epoch based reclamation.
+//
+// reader pins the current epoch into its slot before touching shared data,
+// writer retires old object tagged with the epoch it ends.
+// object is freed, once no pinned reader is at or before its tag.
+//
+// pin / unpin are wait-free - single load and store.
+// retire / reclaim must be serialized by the caller (writer lock).
+
+class EpochDomain{
+	struct alignas(64) Slot{
+		std::atomic<uint64_t>	epoch	{ 0 };
+		std::atomic<bool>	used	{ false };
+	};
+
+	struct Retired{
+		void		*p;
+		void		(*deleter)(void *);
+		uint64_t	epoch;
+	};
+
+public:
+	constexpr static size_t NO_SLOT = static_cast<size_t>(-1);
+
+	explicit EpochDomain(size_t readers = 64) : slots_(new Slot[readers]), readers_(readers){}
+
+	~EpochDomain();
+
+	// NO_SLOT if all slots are taken
+	size_t acquireSlot();
+
+	void releaseSlot(size_t slot){
+		slots_[slot].used.store(false, std::memory_order_release);
+	}
+
+	void pin(size_t slot){
+		slots_[slot].epoch.store(epoch_.load());
+	}
+
+	void unpin(size_t slot){
+		slots_[slot].epoch.store(0, std::memory_order_release);
+	}
+
+	// p must be unreachable for new readers already
+	void retire(void *p, void (*deleter)(void *)){
+		retired_.push_back({ p, deleter, epoch_.fetch_add(1) });
+	}
+
+	size_t reclaim();
+
+	size_t pending() const{
+		return retired_.size();
+	}
+
+private:
+	std::atomic<uint64_t>		epoch_	{ 1 };
+	std::unique_ptr<Slot[]>		slots_;
+	size_t				readers_;
+
+	std::vector<Retired>		retired_;
+};
+
+#endif
+
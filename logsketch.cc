@@ -0,0 +1,68 @@
+#include "logsketch.h"
+#include "tdigest_centroid.h"
+
+#include <cstdio>
+
+void RawLogSketch::print(const Bucket *b) const{
+	printf("Buckets, capacity %zu\n", capacity());
+
+	for(size_t i = 0; i < capacity(); ++i){
+		if (!b[i])
+			continue;
+
+		printf("> Bucket %5zu | value: %10.4f | weight: %5zu\n", i, value_(i), b[i]);
+	}
+}
+
+uint64_t RawLogSketch::weight(const Bucket *b) const{
+	uint64_t weight = 0;
+
+	for(size_t i = 0; i < buckets_; ++i)
+		weight += b[i];
+
+	return weight;
+}
+
+double RawLogSketch::percentile_(const Bucket *b, uint64_t weight, double const p) const{
+	if (weight == 0)
+		return 0;
+
+	double const targetRank = p * static_cast<double>(weight);
+	uint64_t cumulativeWeight = 0;
+
+	size_t last = 0;
+
+	for(size_t i = 0; i < buckets_; ++i){
+		if (!b[i])
+			continue;
+
+		cumulativeWeight += b[i];
+		if (static_cast<double>(cumulativeWeight) >= targetRank)
+			return value_(i);
+
+		last = i;
+	}
+
+	return value_(last);
+}
+
+void RawLogSketch::exportCentroids(const Bucket *b, RawTDigest const &td, Centroid *cd) const{
+	std::vector<Centroid> run;
+
+	for(size_t i = 0; i < buckets_; ++i)
+		if (b[i])
+			run.push_back(Centroid::create(value_(i), b[i]));
+
+	td.clear(cd);
+
+	if (run.empty())
+		return;
+
+	// terminator, so the run is valid blob of its own
+	run.push_back(Centroid::create(0, 0));
+
+	RawTDigest const runTD{ run.size(), td.delta() };
+
+	td.merge(cd, runTD, run.data());
+}
+
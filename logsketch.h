@@ -0,0 +1,140 @@
+#ifndef LOG_SKETCH_H_
+#define LOG_SKETCH_H_
+
+#include "tdigest.h"
+
+#include <cstdint>
+#include <cassert>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>	// copy
+
+// Relative error sketch with logarithmic buckets (DDSketch style),
+// for non-negative values - latencies, sizes, counters.
+//
+// bucket 0 counts values up to minValue (zero and negatives included),
+// bucket i counts values in (minValue * gamma^(i-1), minValue * gamma^i],
+// values above the range go into the last bucket.
+// inside the range, percentile is within relativeAccuracy of the true value.
+//
+// add is O(1), the blob is just array of counts.
+
+class RawLogSketch{
+	size_t	buckets_;
+	double	minValue_;
+	double	gamma_;
+	double	logGamma_;
+
+public:
+	using Bucket	= uint64_t;
+	using Centroid	= RawTDigest::Centroid;
+
+public:
+	RawLogSketch(size_t buckets, double relativeAccuracy, double minValue) :
+					buckets_(buckets),
+					minValue_(minValue),
+					gamma_((1 + relativeAccuracy) / (1 - relativeAccuracy)),
+					logGamma_(std::log(gamma_)){
+		assert(buckets_ >= 2);
+		assert(relativeAccuracy > 0 && relativeAccuracy < 1);
+		assert(minValue_ > 0);
+	}
+
+	constexpr size_t capacity() const{
+		return buckets_;
+	}
+
+	constexpr size_t bytes() const{
+		return buckets_ * sizeof(Bucket);
+	}
+
+	// upper end of the range
+	double maxValue() const{
+		return minValue_ * std::pow(gamma_, static_cast<double>(buckets_ - 1));
+	}
+
+	void print(const Bucket *b) const;
+
+public:
+	void clear(Bucket *b) const{
+		memset(b, 0, bytes());
+	}
+
+	void load(Bucket *b, const void *src) const{
+		memcpy(b, src, bytes());
+	}
+
+	void store(const Bucket *b, void *dest) const{
+		memcpy(dest, b, bytes());
+	}
+
+public:
+	void add(Bucket *b, double value, uint64_t weight = 1) const{
+		b[ index_(value) ] += weight;
+	}
+
+	// src must have the same parameters
+	void merge(Bucket *b, const Bucket *src) const{
+		for(size_t i = 0; i < buckets_; ++i)
+			b[i] += src[i];
+	}
+
+	uint64_t weight(const Bucket *b) const;
+
+	double percentile_50(const Bucket *b) const{
+		return percentile(b, 0.50);
+	}
+
+	double percentile_95(const Bucket *b) const{
+		return percentile(b, 0.95);
+	}
+
+	double percentile(const Bucket *b, double const p) const{
+		assert(p >= 0.00 && p <= 1.00);
+
+		return percentile_(b, weight(b), p);
+	}
+
+	template<typename IT, typename OutIT>
+	void percentile(const Bucket *b, IT first, IT last, OutIT out) const{
+		auto const w = weight(b);
+
+		std::transform(first, last, out, [&](double p){
+			assert(p >= 0.00 && p <= 1.00);
+			return percentile_(b, w, p);
+		});
+	}
+
+	// non-empty buckets as centroids, compressed into cd if they do not fit.
+	void exportCentroids(const Bucket *b, RawTDigest const &td, Centroid *cd) const;
+
+private:
+	size_t index_(double value) const{
+		if (!(value > minValue_))
+			return 0;
+
+		auto const i = std::ceil(std::log(value / minValue_) / logGamma_);
+
+		// +inf and huge values, the cast would be undefined
+		if (!(i < static_cast<double>(buckets_ - 1)))
+			return buckets_ - 1;
+
+		return static_cast<size_t>(i);
+	}
+
+	// value with least relative error inside the bucket
+	double value_(size_t i) const{
+		if (i == 0)
+			return minValue_;
+
+		auto const lower = minValue_ * std::pow(gamma_, static_cast<double>(i - 1));
+
+		return 2 * lower * gamma_ / (1 + gamma_);
+	}
+
+	double percentile_(const Bucket *b, uint64_t weight, double const p) const;
+};
+
+#endif
+
@@ -1,7 +1,23 @@
 #include "tdigest.h"
+#include "tdigest_int.h"
+#include "tdigest_owner.h"
+#include "tdigest_store.h"
+#include "slot_arena.h"
+#include "tdigest_ingest.h"
+#include "tdigest_maintenance.h"
+#include "tdigest_sharded.h"
+#include "tdigest_view.h"
+#include "tdigest_reduce.h"
+#include "tdigest_concurrent.h"
+#include "tdigest_shm.h"
+#include "logsketch.h"
 
 #include <cstdio>
 #include <iterator>
+#include <vector>
+
+#include <unistd.h>
+#include <sys/wait.h>
 
 namespace{
 	constexpr size_t SIZE  = 5;
@@ -116,7 +132,278 @@ int main(){
 
 
 
+	printf("Batch input...\n");
+	{
+		double values[]{ 25.0, 1.50, 1.51, 1.46, 1.47, 1.52, 1.50, -3.0, 1.50, 1.49 };
+
+		td.clearFast(cd);
+		td.add(cd, std::begin(values), std::size(values));
+		td.print(cd);
+		printf("%10.6f\n", td.percentile_50(cd));
+	}
+
+
+
 	free(cd);
+
+
+
+	printf("Owning digest...\n");
+	{
+		std::pmr::monotonic_buffer_resource arena;
+
+		TDigest<> small{ SIZE, DELTA };
+		TDigest<> large{ 64, DELTA, 0.0, &arena };
+
+		for(double x = 1; x < 100; x += 0.5)
+			large.add(x);
+
+		small.add(25.0);
+		small.merge(large);
+
+		TDigest<> moved = std::move(small);
+
+		moved.print();
+		printf("%10.6f, inline %d\n", moved.percentile_50(), moved.isInline());
+
+		printf("Cold storage...\n");
+		large.recompressTo(4);
+		large.print();
+		printf("%10.6f, inline %d\n", large.percentile_50(), large.isInline());
+	}
+
+
+
+	printf("Adaptive store...\n");
+	{
+		TDigestStore store{ DELTA, AdaptiveSizing{ 8, 4, 64, 100, 2 } };
+
+		for(size_t tick = 0; tick < 4; ++tick){
+			for(double x = 0; x < 1000; ++x)
+				store.add("hot", x);
+
+			store.add("cold", 1.0);
+			store.add("cold", 2.0);
+
+			auto const stats = store.tick();
+			printf("tick %zu | keys %zu | bytes %5zu | grown %zu | shrunk %zu\n", tick, stats.keys, stats.bytes, stats.grown, stats.shrunk);
+		}
+
+		for(size_t tick = 4; tick < 8; ++tick){
+			auto const stats = store.tick();
+			printf("tick %zu | keys %zu | bytes %5zu | grown %zu | shrunk %zu\n", tick, stats.keys, stats.bytes, stats.grown, stats.shrunk);
+		}
+
+		printf("%10.6f\n", store.get("hot").percentile_95());
+	}
+
+
+
+	printf("Slot arena...\n");
+	{
+		for(size_t capacity : { 10, 16, 100, 1000 }){
+			auto const c = SlotArena::sizing(capacity);
+			printf("capacity %4zu | bytes %5zu | slot %5zu | fit %4zu | per page %2zu | per huge page %5zu\n",
+						c.capacity, c.bytes, c.slotBytes, c.fitCapacity, c.slotsPerPage, c.slotsPerHugePage);
+		}
+
+		SlotArena arena;
+
+		TDigestStore store{ DELTA, AdaptiveSizing{ 100, 100, 100 }, &arena };
+
+		store.add("a", 1.0);
+		store.add("b", 2.0);
+
+		auto const stats = arena.stats();
+		printf("regions %zu | mapped %zu | used %zu\n", stats.regions, stats.mapped, stats.used);
+	}
+
+
+
+	printf("Ingest queue...\n");
+	{
+		TDigestStore store{ DELTA };
+
+		TDigestIngest ingest{ store };
+
+		for(double x = 1; x <= 100; ++x)
+			ingest.add(x < 50 ? "get" : "put", x);
+
+		ingest.flush();
+
+		ingest.read([](TDigestStore &store){
+			printf("%10.6f %10.6f\n", store.get("get").percentile_50(), store.get("put").percentile_50());
+		});
+
+		auto const stats = ingest.stats();
+
+		printf("applied %llu in %llu batches\n", (unsigned long long) stats.applied, (unsigned long long) stats.batches);
+
+		WorkStealingPool pool{ 2 };
+
+		MaintenanceScheduler maintenance{ pool, MaintenanceConfig{ 1 } };
+
+		maintenance.run(MaintenanceScheduler::Job::SERIALIZE, [&](auto f){
+			return ingest.read(f);
+		});
+
+		for(auto const &blob : maintenance.blobs())
+			printf("%s -> %zu bytes\n", blob.key.c_str(), blob.data.size());
+	}
+
+
+
+	printf("Sharded store...\n");
+	{
+		ShardedTDigestStore store{ DELTA, 4, 1 };
+
+		auto producer = store.producer(0);
+
+		for(double x = 1; x <= 100; ++x)
+			producer.add(x < 50 ? "get" : "put", x);
+
+		store.flush();
+
+		printf("%10.6f\n", store.query("put", [](auto const *digest){
+			return digest->percentile_50();
+		}));
+
+		printf("keys %zu\n", store.stats().keys);
+	}
+
+
+
+	printf("Merged view...\n");
+	{
+		TDigest<> a{ SIZE, DELTA };
+		TDigest<> b{ SIZE, DELTA };
+
+		get(a.data());
+		getBad(b.data());
+
+		MergedView view;
+		view.add(a.raw(), a.data());
+		view.add(b.raw(), b.data());
+
+		view.percentile(std::cbegin(pp), std::cend(pp), std::begin(oo));
+		for(auto const &x : oo)
+			printf("-> %10.6f\n", x);
+
+		printf("cdf(20) %10.6f\n", view.cdf(20));
+	}
+
+
+
+	printf("Tree merge...\n");
+	{
+		std::vector<TDigest<> > hosts;
+
+		for(double host = 0; host < 100; ++host){
+			auto &td = hosts.emplace_back(SIZE, DELTA);
+
+			td.add(host);
+			td.add(host + 0.5);
+		}
+
+		std::vector<const Centroid *> srcs;
+
+		for(auto const &td : hosts)
+			srcs.push_back(td.data());
+
+		WorkStealingPool pool{ 2 };
+
+		TDigest<> global{ SIZE, DELTA };
+
+		mergeTree(pool, global.raw(), global.data(), hosts[0].raw(), srcs.data(), srcs.size(), 4);
+
+		printf("%10.6f, weight %llu\n", global.percentile_50(), (unsigned long long) global.weight());
+
+		std::vector<double> values;
+
+		for(double x = 0; x < 10000; ++x)
+			values.push_back(x / 100);
+
+		buildParallel(pool, global.raw(), global.data(), values.data(), values.size(), 1024);
+
+		printf("%10.6f, weight %llu\n", global.percentile_50(), (unsigned long long) global.weight());
+	}
+
+
+
+	printf("Concurrent...\n");
+	{
+		ConcurrentTDigest ctd{ SIZE, DELTA };
+
+		auto reader = ctd.reader();
+
+		ctd.update([](RawTDigest const &td, Centroid *cd){
+			get(cd);
+			td.add(cd, 1.52);
+		});
+
+		printf("%10.6f, wait-free %d\n", reader.percentile_50(), reader.isWaitFree());
+	}
+
+
+
+	printf("Shared memory...\n");
+	{
+		auto table = SharedTDigestTable::create(64, SIZE, DELTA);
+
+		if (fork() == 0){
+			auto const slot = table.slot("latency");
+
+			for(double x = 1; x <= 100; ++x)
+				table.add(slot, x);
+
+			_exit(0);
+		}
+
+		wait(nullptr);
+
+		printf("%10.6f\n", table.percentile(table.find("latency"), 0.95));
+	}
+
+
+
+	printf("Log sketch...\n");
+	{
+		RawLogSketch ls{ 1024, 0.01, 0.01 };
+
+		std::vector<RawLogSketch::Bucket> b(ls.capacity());
+		ls.clear(b.data());
+
+		for(double x = 1; x <= 1000; ++x)
+			ls.add(b.data(), x);
+
+		ls.percentile(b.data(), std::cbegin(pp), std::cend(pp), std::begin(oo));
+		for(auto const &x : oo)
+			printf("-> %10.6f\n", x);
+
+		TDigest<> exported{ SIZE, DELTA };
+
+		ls.exportCentroids(b.data(), exported.raw(), exported.data());
+		exported.print();
+	}
+
+
+
+	printf("Integer input...\n");
+	{
+		RawIntTDigest td{ SIZE, 2 };
+
+		auto *cd = reinterpret_cast<RawIntTDigest::Centroid *>(malloc(td.bytes()));
+
+		td.clearFast(cd);
+
+		uint64_t values[]{ 1500, 1500, 1501, 1499, 1500, 25000, 1502, 1498, 1500, 1501 };
+
+		td.add(cd, std::begin(values), std::size(values));
+		td.print(cd);
+		printf("%10.6f\n", td.percentile_50(cd));
+
+		free(cd);
+	}
 }
 
 
@@ -0,0 +1,98 @@
+#ifndef MPSC_RING_H_
+#define MPSC_RING_H_
+
+#include <cstdint>
+#include <cassert>
+#include <atomic>
+#include <memory>
+#include <utility>	// move
+
+// Bounded lock-free multi producer, single consumer ring.
+//
+// each cell has sequence number (Vyukov) -
+// producer claims position with CAS on head and publishes the cell,
+// consumer takes cells in order, without atomic read-modify-write.
+
+template<typename T>
+class MPSCRing{
+	struct Cell{
+		std::atomic<size_t>	seq;
+		T			value;
+	};
+
+public:
+	// capacity must be power of 2
+	explicit MPSCRing(size_t capacity) :
+					cells_(new Cell[capacity]),
+					mask_(capacity - 1){
+		assert(capacity >= 2 && (capacity & mask_) == 0);
+
+		for(size_t i = 0; i < capacity; ++i)
+			cells_[i].seq.store(i, std::memory_order_relaxed);
+	}
+
+	size_t capacity() const{
+		return mask_ + 1;
+	}
+
+	// false if full
+	template<typename U>
+	bool tryPush(U &&value){
+		auto pos = head_.load(std::memory_order_relaxed);
+
+		for(;;){
+			auto &cell = cells_[pos & mask_];
+
+			auto const seq  = cell.seq.load(std::memory_order_acquire);
+			auto const diff = static_cast<intptr_t>(seq - pos);
+
+			if (diff == 0){
+				if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+					cell.value = std::forward<U>(value);
+					cell.seq.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			}else if (diff < 0){
+				// consumer did not free the cell yet
+				return false;
+			}else{
+				pos = head_.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// consumer only
+	bool tryPop(T &value){
+		auto &cell = cells_[tail_ & mask_];
+
+		if (cell.seq.load(std::memory_order_acquire) != tail_ + 1)
+			return false;
+
+		value = std::move(cell.value);
+		cell.seq.store(tail_ + mask_ + 1, std::memory_order_release);
+
+		++tail_;
+
+		return true;
+	}
+
+	// positions claimed by the producers so far
+	size_t pushed() const{
+		return head_.load(std::memory_order_acquire);
+	}
+
+	// consumer only
+	size_t popped() const{
+		return tail_;
+	}
+
+private:
+	std::unique_ptr<Cell[]>		cells_;
+	size_t				mask_;
+
+	alignas(64) std::atomic<size_t>	head_	{ 0 };
+	alignas(64) size_t		tail_	= 0;
+};
+
+#endif
+
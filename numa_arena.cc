@@ -0,0 +1,227 @@
+#include "numa_arena.h"
+
+#include <cstdio>
+#include <cerrno>
+#include <cassert>
+#include <algorithm>
+#include <new>		// bad_alloc
+
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+namespace{
+	// "0-3,8-11"
+	template<typename F>
+	bool parseList(const char *file, F f){
+		FILE *fp = fopen(file, "r");
+
+		if (!fp)
+			return false;
+
+		int a, b;
+		char c;
+
+		while(fscanf(fp, "%d", &a) == 1){
+			b = a;
+
+			c = static_cast<char>(fgetc(fp));
+
+			if (c == '-'){
+				if (fscanf(fp, "%d", &b) != 1)
+					break;
+
+				c = static_cast<char>(fgetc(fp));
+			}
+
+			for(int i = a; i <= b; ++i)
+				f(i);
+
+			if (c != ',')
+				break;
+		}
+
+		fclose(fp);
+
+		return true;
+	}
+
+	size_t pageSize(){
+		return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	}
+
+	// status of each page, node or -errno
+	void queryPages(void **pages, int *status, size_t count){
+		if (syscall(SYS_move_pages, 0, count, pages, nullptr, status, 0) != 0)
+			std::fill(status, status + count, -1);
+	}
+}
+
+size_t numa::nodes(){
+	static size_t const nodes = []{
+		int last = 0;
+
+		parseList("/sys/devices/system/node/online", [&](int node){
+			last = std::max(last, node);
+		});
+
+		return static_cast<size_t>(last + 1);
+	}();
+
+	return nodes;
+}
+
+std::vector<int> numa::cpus(int node){
+	std::vector<int> result;
+
+	char file[64];
+	snprintf(file, sizeof file, "/sys/devices/system/node/node%d/cpulist", node);
+
+	if (!parseList(file, [&](int cpu){ result.push_back(cpu); }) && node == 0){
+		// no sysfs, single node
+		for(long i = 0, n = sysconf(_SC_NPROCESSORS_ONLN); i < n; ++i)
+			result.push_back(static_cast<int>(i));
+	}
+
+	return result;
+}
+
+bool numa::pinThread(int node){
+	cpu_set_t set;
+	CPU_ZERO(&set);
+
+	for(auto cpu : cpus(node))
+		if (cpu < CPU_SETSIZE)
+			CPU_SET(cpu, &set);
+
+	if (CPU_COUNT(&set) == 0)
+		return false;
+
+	return sched_setaffinity(0, sizeof set, &set) == 0;
+}
+
+int numa::nodeOf(const void *p){
+	auto *page = reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(p) & ~(pageSize() - 1));
+
+	int status;
+	queryPages(&page, &status, 1);
+
+	return status >= 0 ? status : -1;
+}
+
+
+
+NodeArena::~NodeArena(){
+	for(auto const &m : mappings_)
+		munmap(m.p, m.bytes);
+}
+
+void *NodeArena::map_(size_t bytes){
+	void *p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (p == MAP_FAILED)
+		throw std::bad_alloc{};
+
+	// pages are not touched yet, policy decides where they go on first touch.
+	// preferred, not bind - full node spills instead of OOM.
+	if (numa::nodes() > 1){
+		constexpr size_t BITS = 8 * sizeof(unsigned long);
+
+		std::vector<unsigned long> mask(static_cast<size_t>(node_) / BITS + 1);
+		mask[static_cast<size_t>(node_) / BITS] = 1ul << (static_cast<size_t>(node_) % BITS);
+
+		syscall(SYS_mbind, p, bytes, MPOL_PREFERRED, mask.data(), mask.size() * BITS + 1, 0);
+	}
+
+	mapped_ += bytes;
+
+	return p;
+}
+
+void *NodeArena::do_allocate(size_t bytes, size_t alignment){
+	if (bytes >= CHUNK_SIZE){
+		auto const size = (bytes + pageSize() - 1) & ~(pageSize() - 1);
+
+		void *p = map_(size);
+		mappings_.push_back({ p, size });
+
+		return p;
+	}
+
+	auto align = [alignment](char *p){
+		auto const x = reinterpret_cast<uintptr_t>(p);
+		return reinterpret_cast<char *>((x + alignment - 1) & ~(alignment - 1));
+	};
+
+	if (!head_ || align(head_) + bytes > end_){
+		head_ = static_cast<char *>(map_(CHUNK_SIZE));
+		end_  = head_ + CHUNK_SIZE;
+
+		mappings_.push_back({ head_, CHUNK_SIZE });
+	}
+
+	char *p = align(head_);
+	head_ = p + bytes;
+
+	return p;
+}
+
+void NodeArena::do_deallocate(void *p, size_t bytes, size_t){
+	if (bytes < CHUNK_SIZE)
+		return;
+
+	auto it = std::find_if(std::begin(mappings_), std::end(mappings_), [p](Mapping const &m){
+		return m.p == p;
+	});
+
+	assert(it != std::end(mappings_));
+
+	munmap(it->p, it->bytes);
+
+	mapped_ -= it->bytes;
+
+	mappings_.erase(it);
+}
+
+auto NodeArena::placement() const -> Placement{
+	Placement result;
+
+	result.pages.resize(numa::nodes());
+
+	auto const page = pageSize();
+
+	constexpr size_t BATCH = 512;
+
+	void	*pages[BATCH];
+	int	status[BATCH];
+
+	for(auto const &m : mappings_){
+		auto *p = static_cast<char *>(m.p);
+
+		for(size_t i = 0; i < m.bytes / page; i += BATCH){
+			auto const count = std::min(BATCH, m.bytes / page - i);
+
+			for(size_t j = 0; j < count; ++j)
+				pages[j] = p + (i + j) * page;
+
+			queryPages(pages, status, count);
+
+			for(size_t j = 0; j < count; ++j){
+				auto const s = status[j];
+
+				if (s >= 0 && static_cast<size_t>(s) < result.pages.size()){
+					++result.pages[static_cast<size_t>(s)];
+
+					++(s == node_ ? result.local : result.remote);
+				}else if (s != -ENOENT){
+					++result.unknown;
+				}
+			}
+		}
+	}
+
+	return result;
+}
+
@@ -0,0 +1,91 @@
+#ifndef NUMA_ARENA_H_
+#define NUMA_ARENA_H_
+
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+// NUMA topology and placement, without libnuma.
+// on machine without NUMA everything is node 0.
+
+namespace numa{
+	size_t nodes();
+
+	std::vector<int> cpus(int node);
+
+	// pins calling thread to the cpus of the node
+	bool pinThread(int node);
+
+	// node of the page of p, -1 if unknown
+	int nodeOf(const void *p);
+}
+
+
+
+// Arena with memory preferring single NUMA node.
+//
+// allocates chunks with mmap and sets MPOL_PREFERRED on them with mbind().
+// it is a preference, not a binding - pages spill to other nodes when
+// the node is full.
+// chunks are handed out bump pointer style. small blocks are never
+// returned - use it as upstream of pool resource, that keeps and reuses them.
+// blocks of chunk size and above get own mapping and are unmapped on free.
+
+class NodeArena : public std::pmr::memory_resource{
+public:
+	struct Placement{
+		std::vector<size_t>	pages;	// per node
+		size_t			local	= 0;
+		size_t			remote	= 0;
+		size_t			unknown	= 0;
+	};
+
+	constexpr static size_t CHUNK_SIZE = 2 * 1024 * 1024;
+
+public:
+	explicit NodeArena(int node) : node_(node){}
+
+	NodeArena(NodeArena const &) = delete;
+	NodeArena &operator=(NodeArena const &) = delete;
+
+	~NodeArena() override;
+
+	int node() const{
+		return node_;
+	}
+
+	size_t mapped() const{
+		return mapped_;
+	}
+
+	// where the pages actually are, touched pages only
+	Placement placement() const;
+
+private:
+	void *do_allocate(size_t bytes, size_t alignment) override;
+
+	void do_deallocate(void *p, size_t bytes, size_t alignment) override;
+
+	bool do_is_equal(std::pmr::memory_resource const &other) const noexcept override{
+		return this == &other;
+	}
+
+	void *map_(size_t bytes);
+
+private:
+	struct Mapping{
+		void	*p;
+		size_t	bytes;
+	};
+
+	int			node_;
+
+	std::vector<Mapping>	mappings_;
+	size_t			mapped_	= 0;
+
+	char			*head_	= nullptr;
+	char			*end_	= nullptr;
+};
+
+#endif
+
@@ -0,0 +1,131 @@
+#ifndef RADIX_SORT_H_
+#define RADIX_SORT_H_
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>	// swap, copy
+
+namespace radix_sort_impl_{
+	constexpr unsigned	RADIX_BITS	= 8;
+	constexpr size_t	RADIX_SIZE	= 1 << RADIX_BITS;
+	constexpr unsigned	RADIX_PASSES	= 64 / RADIX_BITS;
+}
+
+// LSD radix sort over 64 bit keys.
+// key(x) must return uint64_t, which orders the same way as x.
+// buffer must have room for (last - first) elements.
+// passes where all keys have the same digit are skipped,
+// so small integers are sorted in one or two passes.
+
+template<typename T, typename Key>
+void radixSort(T *first, T *last, T *buffer, Key key){
+	using namespace radix_sort_impl_;
+
+	size_t const size = static_cast<size_t>(last - first);
+
+	if (size < 2)
+		return;
+
+	size_t count[RADIX_PASSES][RADIX_SIZE] = {};
+
+	for(auto it = first; it != last; ++it){
+		uint64_t const k = key(*it);
+
+		for(unsigned pass = 0; pass < RADIX_PASSES; ++pass)
+			++count[pass][ (k >> (pass * RADIX_BITS)) & (RADIX_SIZE - 1) ];
+	}
+
+	T *src = first;
+	T *dst = buffer;
+
+	for(unsigned pass = 0; pass < RADIX_PASSES; ++pass){
+		auto &c = count[pass];
+
+		// all keys have the same digit
+		if (c[ (key(*src) >> (pass * RADIX_BITS)) & (RADIX_SIZE - 1) ] == size)
+			continue;
+
+		size_t offset = 0;
+		for(auto &x : c){
+			auto const n = x;
+			x = offset;
+			offset += n;
+		}
+
+		for(auto it = src; it != src + size; ++it)
+			dst[ c[ (key(*it) >> (pass * RADIX_BITS)) & (RADIX_SIZE - 1) ]++ ] = *it;
+
+		std::swap(src, dst);
+	}
+
+	if (src != first)
+		std::copy(src, src + size, first);
+}
+
+// order preserving transform of IEEE double:
+// negative values are inverted, positive get the sign bit set.
+// -0.0 sorts before +0.0, NaN sorts outside of +/- infinity,
+// so callers are expected to filter NaN first.
+
+inline uint64_t radixKey(double x){
+	uint64_t u;
+	memcpy(&u, &x, sizeof u);
+
+	return u & (uint64_t{ 1 } << 63) ? ~u : u | (uint64_t{ 1 } << 63);
+}
+
+// Batcher merge exchange network (Knuth 5.2.2 M),
+// works for any size and compiles to branch free min / max.
+
+template<typename T>
+void sortNetwork(T *first, T *last){
+	size_t const size = static_cast<size_t>(last - first);
+
+	if (size < 2)
+		return;
+
+	size_t t = 1;
+	while((size_t{ 1 } << t) < size)
+		++t;
+
+	for(size_t p = size_t{ 1 } << (t - 1); p > 0; p >>= 1){
+		size_t q = size_t{ 1 } << (t - 1);
+		size_t r = 0;
+		size_t d = p;
+
+		while(true){
+			for(size_t i = 0; i + d < size; ++i){
+				if ((i & p) != r)
+					continue;
+
+				auto const a = first[i];
+				auto const b = first[i + d];
+
+				first[i    ] = std::min(a, b);
+				first[i + d] = std::max(a, b);
+			}
+
+			if (q == p)
+				break;
+
+			d = q - p;
+			q >>= 1;
+			r = p;
+		}
+	}
+}
+
+// NaN must be filtered already.
+// buffer must have room for (last - first) elements.
+
+inline void sortDoubles(double *first, double *last, double *buffer){
+	constexpr size_t NETWORK_MAX = 32;
+
+	if (static_cast<size_t>(last - first) <= NETWORK_MAX)
+		return sortNetwork(first, last);
+
+	radixSort(first, last, buffer, radixKey);
+}
+
+#endif
+
@@ -0,0 +1,163 @@
+#include "slot_arena.h"
+#include "tdigest.h"
+
+#include <cassert>
+#include <algorithm>
+#include <new>		// bad_alloc
+
+#include <sys/mman.h>
+
+namespace{
+	constexpr size_t roundUp(size_t a, size_t b){
+		return (a + b - 1) / b * b;
+	}
+
+	void *mapAligned(size_t bytes, size_t alignment){
+		auto const size = bytes + alignment;
+
+		void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (p == MAP_FAILED)
+			return nullptr;
+
+		auto *first   = static_cast<char *>(p);
+		auto *aligned = reinterpret_cast<char *>(roundUp(reinterpret_cast<uintptr_t>(first), alignment));
+		auto *last    = first + size;
+
+		if (aligned != first)
+			munmap(first, static_cast<size_t>(aligned - first));
+
+		if (aligned + bytes != last)
+			munmap(aligned + bytes, static_cast<size_t>(last - (aligned + bytes)));
+
+		return aligned;
+	}
+}
+
+SlotArena::~SlotArena(){
+	for(auto const &m : mappings_)
+		munmap(m.p, m.bytes);
+}
+
+auto SlotArena::sizing(size_t capacity) -> SizeClass{
+	SizeClass c;
+
+	c.capacity		= capacity;
+	c.bytes			= RawTDigest::bytes(capacity);
+	c.slotBytes		= roundUp(c.bytes, LINE_SIZE);
+	c.padding		= c.slotBytes - c.bytes;
+	c.fitCapacity		= c.slotBytes / RawTDigest::bytes(1);
+	c.slotsPerPage		= PAGE_SIZE / c.slotBytes;
+	c.slotsPerHugePage	= REGION_SIZE / c.slotBytes;
+	c.pagesPerSlot		= roundUp(c.slotBytes, PAGE_SIZE) / PAGE_SIZE;
+
+	return c;
+}
+
+void *SlotArena::map_(size_t bytes, bool region){
+	void *p = nullptr;
+
+	bool huge = false;
+
+	if (region && hugePages_ == HugePages::EXPLICIT){
+		p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+		if (p == MAP_FAILED)
+			p = nullptr;
+		else
+			huge = true;
+	}
+
+	if (!p){
+		// 2 MiB aligned, so whole region can be one huge page
+		p = hugePages_ != HugePages::NONE && bytes >= REGION_SIZE ?
+				mapAligned(bytes, REGION_SIZE) :
+				mapAligned(bytes, PAGE_SIZE);
+
+		if (!p)
+			throw std::bad_alloc{};
+
+	#ifdef MADV_HUGEPAGE
+		if (hugePages_ != HugePages::NONE && bytes >= REGION_SIZE)
+			madvise(p, bytes, MADV_HUGEPAGE);
+	#endif
+	}
+
+	mappings_.push_back({ p, bytes });
+
+	++stats_.regions;
+	stats_.hugeRegions += huge;
+	stats_.mapped += bytes;
+
+	return p;
+}
+
+void *SlotArena::do_allocate(size_t bytes, size_t alignment){
+	assert(alignment <= LINE_SIZE);
+	(void) alignment;
+
+	auto const slotBytes = roundUp(std::max<size_t>(bytes, 1), LINE_SIZE);
+
+	stats_.used += slotBytes;
+
+	if (slotBytes > REGION_SIZE)
+		return map_(roundUp(slotBytes, REGION_SIZE), false);
+
+	auto const index = slotBytes / LINE_SIZE;
+
+	if (index >= free_.size()){
+		free_.resize(index + 1, nullptr);
+		inUse_.resize(index + 1, 0);
+	}
+
+	++inUse_[index];
+
+	if (auto *slot = free_[index]){
+		free_[index] = slot->next;
+		stats_.free -= slotBytes;
+
+		return slot;
+	}
+
+	if (!head_ || head_ + slotBytes > end_){
+		// tail of the old region is lost
+		head_ = static_cast<char *>(map_(REGION_SIZE, true));
+		end_  = head_ + REGION_SIZE;
+	}
+
+	void *p = head_;
+	head_ += slotBytes;
+
+	return p;
+}
+
+void SlotArena::do_deallocate(void *p, size_t bytes, size_t){
+	auto const slotBytes = roundUp(std::max<size_t>(bytes, 1), LINE_SIZE);
+
+	stats_.used -= slotBytes;
+
+	if (slotBytes > REGION_SIZE){
+		auto it = std::find_if(std::begin(mappings_), std::end(mappings_), [p](Mapping const &m){
+			return m.p == p;
+		});
+
+		assert(it != std::end(mappings_));
+
+		munmap(it->p, it->bytes);
+
+		--stats_.regions;
+		stats_.mapped -= it->bytes;
+
+		mappings_.erase(it);
+
+		return;
+	}
+
+	auto const index = slotBytes / LINE_SIZE;
+
+	--inUse_[index];
+
+	free_[index] = new(p) FreeSlot{ free_[index] };
+	stats_.free += slotBytes;
+}
+
@@ -0,0 +1,104 @@
+#ifndef SLOT_ARENA_H_
+#define SLOT_ARENA_H_
+
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+// Arena for centroid arrays.
+//
+// every block is cache line aligned slot, rounded to 64 bytes,
+// so digest never shares line with other one.
+// slots are carved from 2 MiB regions backed by huge pages -
+// explicit (MAP_HUGETLB, falls back if the pool is empty)
+// or transparent (2 MiB aligned, MADV_HUGEPAGE).
+// freed slots go to free list per size class.
+//
+// not synchronized - one per thread or shard.
+
+class SlotArena : public std::pmr::memory_resource{
+public:
+	enum class HugePages{
+		NONE		,
+		TRANSPARENT	,
+		EXPLICIT
+	};
+
+	constexpr static size_t LINE_SIZE	= 64;
+	constexpr static size_t PAGE_SIZE	= 4096;
+	constexpr static size_t REGION_SIZE	= 2 * 1024 * 1024;
+
+	// how digest of given capacity fits
+	struct SizeClass{
+		size_t	capacity;
+		size_t	bytes;
+		size_t	slotBytes;
+		size_t	padding;
+		size_t	fitCapacity;		// same slot, no padding
+		size_t	slotsPerPage;		// 0 if slot is bigger than page
+		size_t	slotsPerHugePage;
+		size_t	pagesPerSlot;		// 4K pages touched by single slot
+	};
+
+	struct Stats{
+		size_t	regions		= 0;
+		size_t	hugeRegions	= 0;	// explicit huge pages
+		size_t	mapped		= 0;
+		size_t	used		= 0;	// in live slots
+		size_t	free		= 0;	// in free lists
+	};
+
+public:
+	explicit SlotArena(HugePages hugePages = HugePages::TRANSPARENT) : hugePages_(hugePages){}
+
+	SlotArena(SlotArena const &) = delete;
+	SlotArena &operator=(SlotArena const &) = delete;
+
+	~SlotArena() override;
+
+	static SizeClass sizing(size_t capacity);
+
+	Stats stats() const{
+		return stats_;
+	}
+
+	// slots in use, per size class, index is slotBytes / LINE_SIZE
+	std::vector<size_t> const &slotsInUse() const{
+		return inUse_;
+	}
+
+private:
+	void *do_allocate(size_t bytes, size_t alignment) override;
+
+	void do_deallocate(void *p, size_t bytes, size_t alignment) override;
+
+	bool do_is_equal(std::pmr::memory_resource const &other) const noexcept override{
+		return this == &other;
+	}
+
+	void *map_(size_t bytes, bool region);
+
+private:
+	struct FreeSlot{
+		FreeSlot *next;
+	};
+
+	struct Mapping{
+		void	*p;
+		size_t	bytes;
+	};
+
+	HugePages		hugePages_;
+
+	std::vector<Mapping>	mappings_;
+	std::vector<FreeSlot *>	free_;
+	std::vector<size_t>	inUse_;
+
+	char			*head_	= nullptr;
+	char			*end_	= nullptr;
+
+	Stats			stats_;
+};
+
+#endif
+
@@ -0,0 +1,80 @@
+#ifndef SPSC_RING_H_
+#define SPSC_RING_H_
+
+#include <cstdint>
+#include <cassert>
+#include <atomic>
+#include <memory>
+#include <utility>	// move
+
+// Bounded single producer, single consumer ring.
+//
+// each side owns its index and caches the other one,
+// so the shared cache line is read only when the cache says full / empty.
+
+template<typename T>
+class SPSCRing{
+public:
+	// capacity must be power of 2
+	explicit SPSCRing(size_t capacity) :
+					cells_(new T[capacity]),
+					mask_(capacity - 1){
+		assert(capacity >= 2 && (capacity & mask_) == 0);
+	}
+
+	size_t capacity() const{
+		return mask_ + 1;
+	}
+
+	// producer only, false if full
+	template<typename U>
+	bool tryPush(U &&value){
+		auto const head = head_.load(std::memory_order_relaxed);
+
+		if (head - tailCache_ > mask_){
+			tailCache_ = tail_.load(std::memory_order_acquire);
+
+			if (head - tailCache_ > mask_)
+				return false;
+		}
+
+		cells_[head & mask_] = std::forward<U>(value);
+		head_.store(head + 1, std::memory_order_release);
+
+		return true;
+	}
+
+	// consumer only
+	bool tryPop(T &value){
+		auto const tail = tail_.load(std::memory_order_relaxed);
+
+		if (tail == headCache_){
+			headCache_ = head_.load(std::memory_order_acquire);
+
+			if (tail == headCache_)
+				return false;
+		}
+
+		value = std::move(cells_[tail & mask_]);
+		tail_.store(tail + 1, std::memory_order_release);
+
+		return true;
+	}
+
+	bool empty() const{
+		return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+	}
+
+private:
+	std::unique_ptr<T[]>		cells_;
+	size_t				mask_;
+
+	alignas(64) std::atomic<size_t>	head_		{ 0 };
+	size_t				tailCache_	= 0;	// producer
+
+	alignas(64) std::atomic<size_t>	tail_		{ 0 };
+	size_t				headCache_	= 0;	// consumer
+};
+
+#endif
+
@@ -1,6 +1,14 @@
 #include "tdigest.h"
+#include "tdigest_centroid.h"
+#include "tdigest_common.h"
+#include "tdigest_index.h"
+#include "tdigest_kernel.h"
+#include "radixsort.h"
 
+#include <cmath>
 #include <limits>
+#include <vector>
+#include <numeric>
 #include <cstdio>
 
 namespace {
@@ -13,118 +21,126 @@ namespace {
 	}
 	#endif
 
-	template<typename IT>
-	void insertIntoSortedRange(IT first, IT last, typename std::iterator_traits<IT>::value_type &&item){
-	    auto it = std::lower_bound(first, last, item);
-	    std::move_backward(it, last, std::next(last));
-
-	    *it = std::move(item);
-	}
-}
+	using Centroid = RawTDigest::Centroid;
 
+	// one group, any size
+	Centroid reduceGroup(const Centroid *first, const Centroid *last){
+		if (last - first == 1)
+			return *first;
 
+		auto const [weightedMean, weight_u] = tdigest_kernel::weightedSum(first, static_cast<size_t>(last - first));
 
-struct RawTDigest::Centroid{
-	double   mean_;
-	uint64_t weight_;
+		// keep the mean exact, if all values are the same
+		auto const mean = first->getMean() == std::prev(last)->getMean() ?
+					first->getMean() :
+					weightedMean / static_cast<double>(weight_u);
 
-	constexpr static auto create(double mean, uint64_t weight){
-		return Centroid{ mean, weight };
+		return Centroid::create(mean, weight_u);
 	}
 
-	constexpr void clear(){
-		mean_   = 0;
-		weight_ = 0;
-	}
+	// ends - ascending ends of consecutive groups, last one is the size.
+	// groups are written in place, never past their own start.
+	size_t reduceGroups(Centroid *cd, const size_t *ends, size_t count){
+		size_t newSize = 0;
+		size_t start   = 0;
 
-	constexpr auto getMean() const{
-		return mean_;
-	}
+		for(auto it = ends; it != ends + count; ++it){
+			cd[newSize++] = reduceGroup(cd + start, cd + *it);
 
-	constexpr auto getWeight() const{
-		return weight_;
-	}
+			start = *it;
+		}
 
-	constexpr operator bool() const{
-		return weight_;
+		return newSize;
 	}
+}
 
-	constexpr double getWeightedMean() const{
-		return getMean() * static_cast<double>(getWeight());
-	}
 
-	void print() const{
-		printf("> Addr %p | mean: %10.4f | weight: %5zu\n", (void *) this, getMean(), getWeight());
-	}
 
-	friend constexpr bool operator<(Centroid const &a, Centroid const &b){
-		return a.getMean() < b.getMean();
-	}
-};
+void RawTDigest::print(const Centroid *cd) const{
+	tdigest_common::print(cd, capacity());
+}
 
-static_assert(std::is_trivial_v<RawTDigest::Centroid>);
 
-const size_t RawTDigest::sizeof_Centroid__ = sizeof(RawTDigest::Centroid);
 
+size_t RawTDigest::getSize_(const Centroid *cd) const{
+	return tdigest_kernel::weightAndSize(cd, capacity()).second;
+}
 
+std::pair<uint64_t, size_t> RawTDigest::getWeightAndSize_(const Centroid *cd) const{
+	return tdigest_kernel::weightAndSize(cd, capacity());
+}
 
-void RawTDigest::print(const Centroid *cd) const{
-	printf("Centroids, capacity %zu\n", capacity());
+double RawTDigest::percentile_(const Centroid *cd, size_t size, uint64_t weight, double const p) const{
+	if (size == 0)
+		return 0;
+
+	double const targetRank = p * static_cast<double>(weight);
 
-	for(size_t i = 0; i < capacity(); ++i){
-		auto const &x = cd[i];
-		if (!x)
-			break;
+	// the last centroid is the answer, if nothing before it reaches the rank
+	size_t i;
+	tdigest_kernel::rankCrossing(cd, size - 1, &targetRank, 1, &i);
 
-		x.print();
-	}
+	return cd[i].getMean();
 }
 
+void RawTDigest::percentile_(const Centroid *cd, const double *pp, size_t count, double *out) const{
+	auto [weight, size] = getWeightAndSize_(cd);
 
+	if (size == 0)
+		return std::fill(out, out + count, 0.0);
 
-size_t RawTDigest::getSize_(const Centroid *cd) const{
-	size_t size = 0;
+	assert(count <= PERCENTILE_BATCH);
 
-	for(size_t i = 0; i < capacity(); ++i){
-		auto const &x = cd[i];
-		if (!x)
-			break;
+	size_t order[PERCENTILE_BATCH];
+	std::iota(order, order + count, size_t{ 0 });
+	std::sort(order, order + count, [pp](size_t a, size_t b){
+		return pp[a] < pp[b];
+	});
 
-		++size;
+	double ranks[PERCENTILE_BATCH];
+	for(size_t i = 0; i < count; ++i){
+		assert(pp[order[i]] >= 0.00 && pp[order[i]] <= 1.00);
+		ranks[i] = pp[order[i]] * static_cast<double>(weight);
 	}
 
-	return size;
+	size_t position[PERCENTILE_BATCH];
+	tdigest_kernel::rankCrossing(cd, size - 1, ranks, count, position);
+
+	for(size_t i = 0; i < count; ++i)
+		out[order[i]] = cd[position[i]].getMean();
 }
 
-std::pair<uint64_t, size_t> RawTDigest::getWeightAndSize_(const Centroid *cd) const{
-	std::pair<uint64_t, size_t> r{ 0, 0 };
 
-	for(size_t i = 0; i < capacity(); ++i){
-		auto const &x = cd[i];
-		if (!x)
-			break;
 
-		r.first += x.getWeight();
-		++r.second;
+bool RawTDigest::place_(Centroid *cd, size_t &size, Centroid const &item) const{
+	auto it = lowerBoundBranchless(cd, cd + size, item);
+
+	auto near = [&](Centroid const &x){
+		return std::abs(x.getMean() - item.getMean()) <= epsilon_;
+	};
+
+	// coalesce with the neighbour found by the same search,
+	// merged mean stays between the neighbours, so the range stays sorted.
+	if (it != cd + size && near(*it)){
+		it->merge(item);
+		return true;
 	}
 
-	return r;
-}
+	if (it != cd && near(*std::prev(it))){
+		std::prev(it)->merge(item);
+		return true;
+	}
 
-double RawTDigest::percentile_(const Centroid *cd, size_t size, uint64_t weight, double const p) const{
-	if (size == 0)
-		return 0;
+	if (size == capacity())
+		return false;
 
-	double const targetRank = p * static_cast<double>(weight);
-	double cumulativeWeight = 0;
+	std::move_backward(it, cd + size, cd + size + 1);
+	*it = item;
 
-	for(size_t i = 0; i < size - 1; ++i){
-		cumulativeWeight += static_cast<double>(cd[i].getWeight());
-		if (cumulativeWeight >= targetRank)
-			return cd[i].getMean();
-	}
+	if (++size < capacity())
+		cd[size].clear();
 
-	return cd[size - 1].getMean();
+	return true;
 }
 
 template<RawTDigest::Compression C>
@@ -133,15 +149,10 @@ void RawTDigest::add(Centroid *cd, double value, uint64_t weight) const{
 
 	auto size = getSize_(cd);
 
-	auto insert = [&](){
-		insertIntoSortedRange(cd, cd + size, Centroid::create(value, weight) );
-
-		if (++size < capacity())
-			cd[size].clear();
-	};
+	auto const item = Centroid::create(value, weight);
 
-	if (size < capacity())
-		return insert();
+	if (place_(cd, size, item))
+		return;
 
 	if constexpr(C == Compression::NONE)
 		return;
@@ -152,8 +163,8 @@ void RawTDigest::add(Centroid *cd, double value, uint64_t weight) const{
 	if constexpr(C == Compression::AGGRESSIVE)
 		size = compressAggressive_(cd, size);
 
-	if (size < capacity())
-		return insert();
+	if (place_(cd, size, item))
+		return;
 
 	// drop the value
 	// should be unreachible if Aggressive,
@@ -163,6 +174,60 @@ template void RawTDigest::add<RawTDigest::Compression::NONE		>(Centroid *cd, dou
 template void RawTDigest::add<RawTDigest::Compression::STANDARD		>(Centroid *cd, double value, uint64_t weight) const;
 template void RawTDigest::add<RawTDigest::Compression::AGGRESSIVE	>(Centroid *cd, double value, uint64_t weight) const;
 
+void RawTDigest::add(Centroid *cd, double *values, size_t count) const{
+	count = static_cast<size_t>(std::remove_if(values, values + count, [](double x){
+		return std::isnan(x);
+	}) - values);
+
+	if (count == 0)
+		return;
+
+	{
+		std::vector<double> buffer(count);
+		sortDoubles(values, values + count, buffer.data());
+	}
+
+	std::vector<Centroid> run;
+	tdigest_common::runLength(values, count, run);
+
+	mergeSorted_(cd, getSize_(cd), run.data(), run.size());
+}
+
+void RawTDigest::merge(Centroid *cd, const Centroid *src) const{
+	mergeSorted_(cd, getSize_(cd), src, getSize_(src));
+}
+
+void RawTDigest::merge(Centroid *cd, RawTDigest const &srcTD, const Centroid *src) const{
+	mergeSorted_(cd, getSize_(cd), src, srcTD.getSize_(src));
+}
+
+void RawTDigest::merge(Centroid *cd, RawTDigest const &srcTD, const Centroid *const *srcs, size_t count) const{
+	size_t size = getSize_(cd);
+
+	std::vector<Centroid> buffer{ cd, cd + size };
+
+	for(size_t i = 0; i < count; ++i){
+		auto const middle = buffer.size();
+
+		buffer.insert(std::end(buffer), srcs[i], srcs[i] + srcTD.getSize_(srcs[i]));
+
+		// runs are sorted
+		std::inplace_merge(buffer.data(), buffer.data() + middle, buffer.data() + buffer.size());
+	}
+
+	size = compressToFit_(buffer.data(), buffer.size());
+
+	std::copy(buffer.data(), buffer.data() + size, cd);
+	if (size < capacity())
+		cd[size].clear();
+}
+
+void RawTDigest::mergeSorted_(Centroid *cd, size_t size, const Centroid *src, size_t srcSize) const{
+	tdigest_common::mergeSorted(cd, size, capacity(), src, srcSize, [this](Centroid *buffer, size_t count){
+		return compressToFit_(buffer, count);
+	});
+}
+
 
 
 size_t RawTDigest::compressNormal_(Centroid *cd, size_t size) const{
@@ -184,37 +249,171 @@ size_t RawTDigest::compressAggressive_(Centroid *cd, size_t size) const{
 		return compressCentroids_<1>(cd, size, delta_);
 }
 
+size_t RawTDigest::compressToFit_(Centroid *cd, size_t size) const{
+	if (size < 2)
+		return size;
+
+	// coalesce the same way add() does, it costs no accuracy
+	size_t newSize = 0;
+	for(size_t i = 1; i < size; ++i){
+		if (std::abs(cd[i].getMean() - cd[newSize].getMean()) <= epsilon_)
+			cd[newSize].merge(cd[i]);
+		else
+			cd[++newSize] = cd[i];
+	}
+
+	size = newSize + 1;
+
+	if (size > capacity())
+		size = compressCentroids_<1>(cd, size, delta_);
+
+	// each pass merges at least the closest pair
+	while(size > capacity())
+		size = compressCentroids_<0>(cd, size, findMinDistance__(cd, size));
+
+	return size;
+}
+
 template<bool UseWeight>
 size_t RawTDigest::compressCentroids_(Centroid *cd, size_t size, double delta) const{
 	assert(size > 1);
 
+	// group grows while its span (times its weight) is within delta.
+	// the kernel finds the end a block at a time, the group is reduced
+	// right away - write index never passes the group start.
+
 	size_t newSize = 0;
-	auto   current = cd[0];
 
-	auto const _ = [](double weight) -> double{
-		if constexpr(UseWeight)
-			return weight;
-		else
-			return 1.0;
+	for(size_t start = 0; start < size;){
+		auto const end = tdigest_kernel::groupEnd(cd, start, size, delta, UseWeight);
+
+		cd[newSize++] = reduceGroup(cd + start, cd + end);
+
+		start = end;
+	}
+
+	if (newSize < capacity())
+		cd[newSize].clear();
+
+	return newSize;
+}
+
+
+
+size_t RawTDigest::recompressTo(Centroid *cd, size_t const targetCapacity) const{
+	assert(targetCapacity >= 1);
+
+	auto const [weight_u, size] = getWeightAndSize_(cd);
+
+	if (size <= targetCapacity)
+		return size;
+
+	// quantile error - query at rank q inside a merged group returns the
+	// group mean, and the true rank of that is where the mean falls
+	// among the group. error is the distance of q to it, in k-scale
+	// units k(q) = asin(2q - 1), which stretch the tails the way
+	// t-digest does. integrated over the group it is
+	//	(k(L) - k(a))^2 + (k(b) - k(R))^2
+	// [a, b) - group ranks, [L, R) - ranks of centroids equal to the mean.
+	// single centroid or equal values cost nothing.
+
+	auto const shift = cd[size / 2].getMean();
+	auto const total = static_cast<double>(weight_u);
+
+	// prefix sums of weight and weighted mean, k of the prefix rank.
+	// means are shifted by the median, against cancellation.
+
+	std::vector<double> w(size + 1), s1(size + 1), k(size + 1);
+
+	for(size_t i = 0; i < size; ++i){
+		auto const weight = static_cast<double>(cd[i].getWeight());
+
+		w [i + 1] = w [i] + weight;
+		s1[i + 1] = s1[i] + weight * (cd[i].getMean() - shift);
+	}
+
+	for(size_t i = 0; i <= size; ++i)
+		k[i] = std::asin(std::clamp(2 * w[i] / total - 1, -1.0, 1.0));
+
+	// error of merging [i, j) into one centroid
+	auto cost = [&](size_t i, size_t j){
+		if (cd[i].getMean() == cd[j - 1].getMean())
+			return 0.0;
+
+		auto const mean = (s1[j] - s1[i]) / (w[j] - w[i]) + shift;
+
+		auto const lo = static_cast<size_t>(lowerBoundBranchless(cd + i, cd + j, Centroid::create(mean, 1)) - cd);
+
+		auto hi = lo;
+		while(hi < j && cd[hi].getMean() == mean)
+			++hi;
+
+		auto const below = k[lo] - k[i];
+		auto const above = k[j]  - k[hi];
+
+		return below * below + above * above;
 	};
 
-	for (size_t i = 1; i < size; ++i){
-		auto const distance = std::abs(cd[i].getMean() - current.getMean());
-		auto const weight_u = current.getWeight() + cd[i].getWeight();
-		auto const weight   = static_cast<double>(weight_u);
-
-		if (_(weight) * distance <= delta) {
-			current = Centroid::create(
-					(current.getWeightedMean() + cd[i].getWeightedMean()) / weight,
-					weight_u
-			);
-		}else{
-			cd[newSize++] = current;
-			current = cd[i];
+	// below + above is the group k-span without the run of centroids
+	// equal to the mean, so cost >= (span - widest run)^2 / 2.
+	// that grows as the group does, and bounds the search.
+
+	double widest = 0;
+
+	for(size_t i = 0, j = 1; i < size; i = j++){
+		while(j < size && cd[j].getMean() == cd[i].getMean())
+			++j;
+
+		widest = std::max(widest, k[j] - k[i]);
+	}
+
+	// dp[j] - least error of the first j centroids in k groups.
+	// the cost has no monotone split point, so each row tries the
+	// splits from j down, until the bound stops it.
+	// row k needs j only up to size - (targetCapacity - k).
+
+	std::vector<double> prev(size + 1), curr(size + 1);
+	std::vector<size_t> split(targetCapacity * (size + 1));
+
+	for(size_t j = 1; j <= size; ++j)
+		prev[j] = cost(0, j);
+
+	for(size_t g = 2; g <= targetCapacity; ++g){
+		auto *row = &split[(g - 1) * (size + 1)];
+
+		for(size_t j = g; j <= size - (targetCapacity - g); ++j){
+			double best  = std::numeric_limits<double>::max();
+			size_t bestI = j - 1;
+
+			for(size_t i = j; i-- > g - 1;){
+				auto const span = k[j] - k[i] - widest;
+
+				if (span > 0 && span * span / 2 >= best)
+					break;
+
+				auto const c = prev[i] + cost(i, j);
+
+				if (c < best){
+					best  = c;
+					bestI = i;
+				}
+			}
+
+			curr[j] = best;
+			row[j]  = bestI;
 		}
+
+		std::swap(prev, curr);
+	}
+
+	std::vector<size_t> ends(targetCapacity);
+
+	for(size_t g = targetCapacity, j = size; g > 0; --g){
+		ends[g - 1] = j;
+		j = split[(g - 1) * (size + 1) + j];
 	}
 
-	cd[newSize++] = current;
+	auto const newSize = reduceGroups(cd, ends.data(), ends.size());
 
 	if (newSize < capacity())
 		cd[newSize].clear();
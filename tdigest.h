@@ -4,20 +4,30 @@
 #include <cstdint>
 #include <cassert>
 #include <cstring>
-#include <algorithm>	// transform
+#include <algorithm>	// copy
 
 class RawTDigest{
 	size_t	capacity_;
 	double	delta_;
+	double	epsilon_;
 
-	static const size_t sizeof_Centroid__;
+	// checked in tdigest_centroid.h
+	constexpr static size_t sizeof_Centroid__ = 16;
+
+	// percentiles per pass
+	constexpr static size_t PERCENTILE_BATCH = 32;
 
 public:
 	struct Centroid;
 
 public:
-	constexpr RawTDigest(size_t capacity, double delta) : capacity_(capacity), delta_(delta){
+	// epsilon - values that close to existing centroid are merged into it on add.
+	constexpr RawTDigest(size_t capacity, double delta, double epsilon = 0.0) :
+					capacity_(capacity),
+					delta_(delta),
+					epsilon_(epsilon){
 		assert(capacity_ >= 2);
+		assert(epsilon_ >= 0);
 	}
 
 	enum class Compression{
@@ -30,8 +40,20 @@ public:
 		return capacity_;
 	}
 
+	constexpr double delta() const{
+		return delta_;
+	}
+
+	constexpr double epsilon() const{
+		return epsilon_;
+	}
+
 	constexpr size_t bytes() const{
-		return capacity_ * sizeof_Centroid__;
+		return bytes(capacity_);
+	}
+
+	constexpr static size_t bytes(size_t capacity){
+		return capacity * sizeof_Centroid__;
 	}
 
 	void print(const Centroid *cd) const;
@@ -57,12 +79,38 @@ public:
 	template<Compression C = Compression::AGGRESSIVE>
 	void add(Centroid *cd, double value, uint64_t weight = 1) const;
 
+	// values are sorted in place, NaN are skipped
+	void add(Centroid *cd, double *values, size_t count) const;
+
+	void merge(Centroid *cd, const Centroid *src) const;
+
+	// src may have different capacity
+	void merge(Centroid *cd, RawTDigest const &srcTD, const Centroid *src) const;
+
+	// count blobs at once, single compression instead of one per blob
+	void merge(Centroid *cd, RawTDigest const &srcTD, const Centroid *const *srcs, size_t count) const;
+
+	size_t size(const Centroid *cd) const{
+		return getSize_(cd);
+	}
+
+	uint64_t weight(const Centroid *cd) const{
+		return getWeightAndSize_(cd).first;
+	}
+
 	size_t compress(Centroid *cd) const{
 		size_t const size = getSize_(cd);
 
 		return compressNormal_(cd, size);
 	}
 
+	// offline, optimal partition into targetCapacity centroids
+	// with least rank error of the quantiles, in k-scale units,
+	// so the tails keep small centroids. O(targetCapacity size^2) at worst.
+	// the first targetCapacity centroids form valid blob
+	// for RawTDigest with that capacity.
+	size_t recompressTo(Centroid *cd, size_t targetCapacity) const;
+
 	double percentile_50(const Centroid *cd) const{
 		return percentile(cd, 0.50);
 	}
@@ -79,29 +127,45 @@ public:
 		return percentile_(cd, size, weight, p);
 	}
 
+	// percentiles are found in single pass per PERCENTILE_BATCH of them,
+	// no allocation.
 	template<typename IT, typename OutIT>
 	void percentile(const Centroid *cd, IT first, IT last, OutIT out) const{
-		auto [weight, size] = getWeightAndSize_(cd);
+		double pp[PERCENTILE_BATCH];
+		double oo[PERCENTILE_BATCH];
+
+		while(first != last){
+			size_t count = 0;
 
-		auto f = [&](double p){
-			assert(p >= 0.00 && p <= 1.00);
-			return percentile_(cd, size, weight, p);
-		};
+			for(; count < PERCENTILE_BATCH && first != last; ++first)
+				pp[count++] = *first;
 
-		std::transform(first, last, out, f);
+			percentile_(cd, pp, count, oo);
+
+			out = std::copy(oo, oo + count, out);
+		}
 	}
 
 private:
 	size_t getSize_(const Centroid *cd) const;
 
+	bool place_(Centroid *cd, size_t &size, Centroid const &item) const;
+
+	void mergeSorted_(Centroid *cd, size_t size, const Centroid *src, size_t srcSize) const;
+
 	std::pair<uint64_t, size_t> getWeightAndSize_(const Centroid *cd) const;
 
 	double percentile_(const Centroid *cd, size_t size, uint64_t weight, double const p) const;
 
+	// count <= PERCENTILE_BATCH
+	void percentile_(const Centroid *cd, const double *pp, size_t count, double *out) const;
+
 	size_t compressNormal_(Centroid *cd, size_t size) const;
 
 	size_t compressAggressive_(Centroid *cd, size_t size) const;
 
+	size_t compressToFit_(Centroid *cd, size_t size) const;
+
 	template<bool UseWeight>
 	size_t compressCentroids_(Centroid *cd, size_t size, double delta) const;
 
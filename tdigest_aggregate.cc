@@ -0,0 +1,257 @@
+#include "tdigest_aggregate.h"
+#include "tdigest_reduce.h"
+#include "tdigest_centroid.h"
+
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cassert>
+#include <algorithm>	// max
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace{
+	// full count, unless EOF or error
+	ssize_t readFull(int fd, void *buffer, size_t count){
+		auto *p = static_cast<char *>(buffer);
+
+		size_t done = 0;
+
+		while(done < count){
+			auto const n = read(fd, p + done, count - done);
+
+			if (n < 0){
+				if (errno == EINTR)
+					continue;
+
+				return -1;
+			}
+
+			if (n == 0)
+				break;
+
+			done += static_cast<size_t>(n);
+		}
+
+		return static_cast<ssize_t>(done);
+	}
+
+	bool preadFull(int fd, void *buffer, size_t count, off_t offset){
+		auto *p = static_cast<char *>(buffer);
+
+		while(count){
+			auto const n = pread(fd, p, count, offset);
+
+			if (n < 0 && errno == EINTR)
+				continue;
+
+			if (n <= 0)
+				return false;
+
+			p	+= n;
+			offset	+= n;
+			count	-= static_cast<size_t>(n);
+		}
+
+		return true;
+	}
+
+	// at explicit offset - failed write leaves nothing to skip over
+	bool pwriteFull(int fd, const void *buffer, size_t count, off_t offset){
+		auto const *p = static_cast<const char *>(buffer);
+
+		while(count){
+			auto const n = pwrite(fd, p, count, offset);
+
+			if (n < 0){
+				if (errno == EINTR)
+					continue;
+
+				return false;
+			}
+
+			p	+= n;
+			offset	+= n;
+			count	-= static_cast<size_t>(n);
+		}
+
+		return true;
+	}
+}
+
+FileAggregator::FileAggregator(RawTDigest const &td, WorkStealingPool &pool, AggregateConfig const &config) :
+				td_(td),
+				pool_(pool),
+				config_(config){
+	assert(config_.pending >= 2);
+
+	config_.chunkBytes = std::max(config_.chunkBytes / sizeof(double), size_t{ 1 }) * sizeof(double);
+
+	buffer_	= std::make_unique<double[]>(config_.chunkBytes / sizeof(double));
+	slots_	= std::make_unique<Centroid[]>(config_.pending * td_.capacity());
+}
+
+FileAggregator::~FileAggregator(){
+	if (spillFD_ >= 0)
+		close(spillFD_);
+}
+
+auto FileAggregator::slot_(size_t i) const -> Centroid *{
+	return slots_.get() + i * td_.capacity();
+}
+
+bool FileAggregator::addFile(const char *path){
+	int const fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return false;
+
+	++stats_.files;
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	auto const chunk = config_.chunkBytes;
+
+	off_t offset = 0;
+
+	bool ok = true;
+
+	for(;;){
+		// next chunk is read by the kernel while this one is built
+		posix_fadvise(fd, offset + static_cast<off_t>(chunk), static_cast<off_t>(chunk), POSIX_FADV_WILLNEED);
+
+		auto const n = readFull(fd, buffer_.get(), chunk);
+
+		if (n < 0){
+			ok = false;
+			break;
+		}
+
+		auto const bytes = static_cast<size_t>(n);
+
+		stats_.bytes += bytes;
+
+		if (!addChunk(buffer_.get(), bytes / sizeof(double))){
+			ok = false;
+			break;
+		}
+
+		// done with it, keep the page cache bounded too
+		posix_fadvise(fd, offset, static_cast<off_t>(bytes), POSIX_FADV_DONTNEED);
+
+		offset += static_cast<off_t>(bytes);
+
+		if (bytes < chunk){
+			stats_.skippedBytes += bytes % sizeof(double);
+			break;
+		}
+	}
+
+	close(fd);
+
+	return ok;
+}
+
+bool FileAggregator::addChunk(double *values, size_t count){
+	if (count == 0)
+		return true;
+
+	if (pending_ == config_.pending && !spill_())
+		return false;
+
+	buildParallel(pool_, td_, slot_(pending_), values, count);
+
+	++pending_;
+
+	++stats_.chunks;
+	stats_.values += count;
+
+	return true;
+}
+
+void FileAggregator::mergePending_(Centroid *dest, size_t count) const{
+	std::vector<const Centroid *> srcs(count);
+
+	for(size_t i = 0; i < count; ++i)
+		srcs[i] = slot_(i);
+
+	mergeTree(pool_, td_, dest, td_, srcs.data(), srcs.size());
+}
+
+bool FileAggregator::spill_(){
+	if (spillFD_ < 0){
+		std::string path = std::string{ config_.spillDir } + "/tdigest-spill-XXXXXX";
+
+		spillFD_ = mkstemp(path.data());
+
+		if (spillFD_ < 0)
+			return false;
+
+		// gone, when closed
+		unlink(path.c_str());
+	}
+
+	std::vector<Centroid> merged(td_.capacity());
+
+	mergePending_(merged.data(), pending_);
+
+	// spill k is at k * bytes, whatever the failed writes before
+	auto const offset = static_cast<off_t>(spilled_ * td_.bytes());
+
+	if (!pwriteFull(spillFD_, merged.data(), td_.bytes(), offset))
+		return false;
+
+	pending_ = 0;
+
+	++spilled_;
+	++stats_.spills;
+
+	return true;
+}
+
+bool FileAggregator::finish(Centroid *dest){
+	if (spilled_ == 0){
+		if (pending_)
+			mergePending_(dest, pending_);
+		else
+			td_.clearFast(dest);
+
+		pending_ = 0;
+
+		return true;
+	}
+
+	if (pending_ && !spill_())
+		return false;
+
+	// slot 0 carries the result of the previous group
+	size_t next = 0;
+	size_t count = 0;
+
+	while(next < spilled_){
+		while(count < config_.pending && next < spilled_){
+			auto const offset = static_cast<off_t>(next * td_.bytes());
+
+			if (!preadFull(spillFD_, slot_(count), td_.bytes(), offset))
+				return false;
+
+			++count;
+			++next;
+		}
+
+		mergePending_(dest, count);
+
+		td_.load(slot_(0), dest);
+
+		count = 1;
+	}
+
+	// next aggregation starts clean
+	close(spillFD_);
+
+	spillFD_	= -1;
+	spilled_	= 0;
+
+	return true;
+}
@@ -0,0 +1,82 @@
+#ifndef T_DIGEST_AGGREGATE_H_
+#define T_DIGEST_AGGREGATE_H_
+
+#include "tdigest.h"
+#include "thread_pool.h"
+
+#include <memory>
+
+// Out of core aggregation of raw sample files.
+//
+// file of native doubles is read in large sequential chunks,
+// the next chunk is prefetched with readahead hint.
+// each chunk is built into digest in parallel, up to pending chunk digests
+// are kept, then tree merged into one and spilled to unlinked temp file.
+// finish() merges the spills back, pending at a time.
+//
+// memory is chunkBytes + pending digests, whatever the size of the input.
+
+struct AggregateConfig{
+	size_t		chunkBytes	= 64 << 20;
+	size_t		pending		= 64;
+	const char	*spillDir	= "/tmp";
+};
+
+class FileAggregator{
+public:
+	using Centroid = RawTDigest::Centroid;
+
+	struct Stats{
+		size_t		files		= 0;
+		size_t		bytes		= 0;
+		size_t		values		= 0;
+		size_t		chunks		= 0;
+		size_t		spills		= 0;
+		size_t		skippedBytes	= 0;	// trailing partial value
+	};
+
+public:
+	FileAggregator(RawTDigest const &td, WorkStealingPool &pool, AggregateConfig const &config = {});
+
+	FileAggregator(FileAggregator const &) = delete;
+	FileAggregator &operator=(FileAggregator const &) = delete;
+
+	~FileAggregator();
+
+	// false on I/O error, values read so far are kept
+	bool addFile(const char *path);
+
+	// values are sorted in place
+	bool addChunk(double *values, size_t count);
+
+	// merges everything into dest, false on I/O error
+	bool finish(Centroid *dest);
+
+	Stats const &stats() const{
+		return stats_;
+	}
+
+private:
+	Centroid *slot_(size_t i) const;
+
+	bool spill_();
+
+	void mergePending_(Centroid *dest, size_t count) const;
+
+private:
+	RawTDigest			td_;
+	WorkStealingPool		&pool_;
+	AggregateConfig			config_;
+
+	std::unique_ptr<double[]>	buffer_;
+	std::unique_ptr<Centroid[]>	slots_;
+	size_t				pending_	= 0;
+
+	int				spillFD_	= -1;
+	size_t				spilled_	= 0;	// blobs in the spill file
+
+	Stats				stats_;
+};
+
+#endif
+
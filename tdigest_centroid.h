@@ -0,0 +1,64 @@
+#ifndef T_DIGEST_CENTROID_H_
+#define T_DIGEST_CENTROID_H_
+
+// internal - layout of the centroid blob,
+// for the library translation units only.
+
+#include "tdigest.h"
+
+#include <cstdio>
+#include <type_traits>
+
+struct RawTDigest::Centroid{
+	double   mean_;
+	uint64_t weight_;
+
+	constexpr static auto create(double mean, uint64_t weight){
+		return Centroid{ mean, weight };
+	}
+
+	constexpr void clear(){
+		mean_   = 0;
+		weight_ = 0;
+	}
+
+	constexpr auto getMean() const{
+		return mean_;
+	}
+
+	constexpr auto getWeight() const{
+		return weight_;
+	}
+
+	constexpr operator bool() const{
+		return weight_;
+	}
+
+	constexpr double getWeightedMean() const{
+		return getMean() * static_cast<double>(getWeight());
+	}
+
+	constexpr void merge(Centroid const &other){
+		auto const weight_u = getWeight() + other.getWeight();
+
+		// keep the mean exact, if the values are the same
+		if (getMean() != other.getMean())
+			mean_ = (getWeightedMean() + other.getWeightedMean()) / static_cast<double>(weight_u);
+
+		weight_ = weight_u;
+	}
+
+	void print() const{
+		printf("> Addr %p | mean: %10.4f | weight: %5zu\n", (void *) this, getMean(), getWeight());
+	}
+
+	friend constexpr bool operator<(Centroid const &a, Centroid const &b){
+		return a.getMean() < b.getMean();
+	}
+};
+
+static_assert(std::is_trivial_v<RawTDigest::Centroid>);
+static_assert(sizeof(RawTDigest::Centroid) == RawTDigest::bytes(1));
+
+#endif
+
@@ -0,0 +1,492 @@
+#include "tdigest_owner.h"
+#include "tdigest_reduce.h"
+#include "thread_pool.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <charconv>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+
+// tdigest - percentiles of number streams.
+//
+// input is read in large chunks, each chunk is split into fixed pieces
+// on line boundaries, pieces are parsed (std::from_chars) and built
+// into digests in parallel, then merged in piece order.
+// pieces do not depend on the threads, so neither does the output.
+
+namespace{
+	enum class Format{
+		TEXT	,
+		CSV	,
+		BINARY
+	};
+
+	struct Options{
+		Format			format		= Format::TEXT;
+		char			delimiter	= ',';
+		size_t			column		= 1;
+		size_t			keyColumn	= 0;		// 0 - no key
+		size_t			capacity	= 100;
+		double			delta		= 0.01;
+		size_t			threads		= std::thread::hardware_concurrency();
+		std::vector<double>	quantiles;
+		const char		*output		= nullptr;
+	};
+
+	constexpr size_t CHUNK_SIZE	= 64 << 20;
+	constexpr size_t PIECE_SIZE	= 1 << 20;
+
+	using Digest	= TDigest<>;
+	using Digests	= std::map<std::string, Digest, std::less<> >;
+
+	struct Piece{
+		std::vector<double>						values;
+		std::unordered_map<std::string_view, std::vector<double> >	keyed;
+		size_t								bad	= 0;
+	};
+
+	std::string_view trim(std::string_view s){
+		while(!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+			s.remove_prefix(1);
+
+		while(!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r'))
+			s.remove_suffix(1);
+
+		return s;
+	}
+
+	// column is 1 based
+	bool field(std::string_view line, char delimiter, size_t column, std::string_view &result){
+		for(size_t i = 1; ; ++i){
+			auto const pos = line.find(delimiter);
+
+			if (i == column){
+				result = trim(line.substr(0, pos));
+				return true;
+			}
+
+			if (pos == std::string_view::npos)
+				return false;
+
+			line.remove_prefix(pos + 1);
+		}
+	}
+
+	bool parseDouble(std::string_view s, double &value){
+		if (!s.empty() && s.front() == '+')
+			s.remove_prefix(1);
+
+		auto const [p, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+
+		return ec == std::errc{} && p == s.data() + s.size();
+	}
+
+	void parsePiece(Options const &options, std::string_view text, Piece &piece){
+		while(!text.empty()){
+			auto const eol = text.find('\n');
+
+			auto line = text.substr(0, eol);
+
+			text.remove_prefix(eol == std::string_view::npos ? text.size() : eol + 1);
+
+			std::string_view number = trim(line);
+			std::string_view key;
+
+			if (number.empty())
+				continue;
+
+			if (options.format == Format::CSV){
+				if (!field(line, options.delimiter, options.column, number)){
+					++piece.bad;
+					continue;
+				}
+
+				if (options.keyColumn && !field(line, options.delimiter, options.keyColumn, key)){
+					++piece.bad;
+					continue;
+				}
+			}
+
+			double value;
+
+			if (!parseDouble(number, value)){
+				++piece.bad;
+				continue;
+			}
+
+			if (options.keyColumn)
+				piece.keyed[key].push_back(value);
+			else
+				piece.values.push_back(value);
+		}
+	}
+
+
+
+	class Aggregator{
+	public:
+		explicit Aggregator(Options const &options) :
+						options_(options),
+						td_(options.capacity, options.delta),
+						pool_(options.threads){}
+
+		// whole lines only
+		void text(std::string_view chunk);
+
+		void binary(double *values, size_t count);
+
+		Digests const &digests() const{
+			return digests_;
+		}
+
+		size_t bad() const{
+			return bad_;
+		}
+
+	private:
+		Digest &get_(std::string_view key){
+			auto it = digests_.find(key);
+
+			if (it == digests_.end())
+				it = digests_.try_emplace(std::string{ key }, options_.capacity, options_.delta).first;
+
+			return it->second;
+		}
+
+	private:
+		Options const		&options_;
+		RawTDigest		td_;
+		WorkStealingPool	pool_;
+
+		Digests			digests_;
+		size_t			bad_	= 0;
+	};
+
+	void Aggregator::text(std::string_view chunk){
+		std::vector<std::string_view> pieces;
+
+		while(!chunk.empty()){
+			auto end = chunk.size() <= PIECE_SIZE ? std::string_view::npos : chunk.find('\n', PIECE_SIZE);
+
+			end = end == std::string_view::npos ? chunk.size() : end + 1;
+
+			pieces.push_back(chunk.substr(0, end));
+			chunk.remove_prefix(end);
+		}
+
+		std::vector<Piece> parsed(pieces.size());
+
+		// parse and build in parallel, merge in order
+		std::vector<Digests> built(pieces.size());
+
+		pool_.parallelFor(pieces.size(), [&](size_t i){
+			auto &piece = parsed[i];
+
+			parsePiece(options_, pieces[i], piece);
+
+			auto build = [&](std::string_view key, std::vector<double> &values){
+				auto &digest = built[i].try_emplace(std::string{ key }, options_.capacity, options_.delta).first->second;
+				digest.add(values.data(), values.size());
+			};
+
+			if (!piece.values.empty())
+				build("", piece.values);
+
+			for(auto &[key, values] : piece.keyed)
+				build(key, values);
+		});
+
+		for(size_t i = 0; i < pieces.size(); ++i){
+			bad_ += parsed[i].bad;
+
+			for(auto const &[key, digest] : built[i])
+				get_(key).merge(digest);
+		}
+	}
+
+	void Aggregator::binary(double *values, size_t count){
+		Digest chunk{ options_.capacity, options_.delta };
+
+		buildParallel(pool_, td_, chunk.data(), values, count, PIECE_SIZE / sizeof(double));
+
+		get_("").merge(chunk);
+	}
+
+
+
+	enum class Input{
+		OK		,
+		ERROR		,	// errno is set
+		LONG_LINE
+	};
+
+	Input readInput(int fd, Options const &options, Aggregator &aggregator){
+		std::vector<char> buffer(CHUNK_SIZE);
+
+		size_t size = 0;
+
+		for(;;){
+			auto const n = read(fd, buffer.data() + size, buffer.size() - size);
+
+			if (n < 0){
+				if (errno == EINTR)
+					continue;
+
+				return Input::ERROR;
+			}
+
+			size += static_cast<size_t>(n);
+
+			bool const eof = n == 0;
+
+			if (!eof && size < buffer.size())
+				continue;
+
+			if (options.format == Format::BINARY){
+				auto const count = size / sizeof(double);
+
+				std::vector<double> values(count);
+				memcpy(values.data(), buffer.data(), count * sizeof(double));
+
+				aggregator.binary(values.data(), count);
+
+				// partial value waits for the next read
+				memmove(buffer.data(), buffer.data() + count * sizeof(double), size - count * sizeof(double));
+				size -= count * sizeof(double);
+			}else{
+				std::string_view const chunk{ buffer.data(), size };
+
+				auto const last = eof ? size : chunk.rfind('\n') + 1;
+
+				if (last == 0 && size == buffer.size())
+					return Input::LONG_LINE;
+
+				aggregator.text(chunk.substr(0, last));
+
+				// partial line waits for the next read
+				memmove(buffer.data(), buffer.data() + last, size - last);
+				size -= last;
+			}
+
+			if (eof)
+				return Input::OK;
+		}
+	}
+
+	// perror only for I/O errors, errno says nothing about long line
+	bool reportInput(const char *name, Input input){
+		switch(input){
+		case Input::OK:
+			return true;
+
+		case Input::ERROR:
+			perror(name);
+			return false;
+
+		case Input::LONG_LINE:
+			fprintf(stderr, "%s: line longer than %zu bytes\n", name, CHUNK_SIZE);
+			return false;
+		}
+
+		return false;
+	}
+
+	// record - key size, key, capacity, delta, blob
+	bool writeDigests(const char *path, Digests const &digests){
+		FILE *fp = fopen(path, "wb");
+
+		if (!fp)
+			return false;
+
+		bool ok = fwrite("TDG1", 4, 1, fp) == 1;
+
+		for(auto const &[key, digest] : digests){
+			uint32_t const keySize	= static_cast<uint32_t>(key.size());
+			uint64_t const capacity	= digest.capacity();
+			double   const delta	= digest.raw().delta();
+
+			std::vector<char> blob(digest.bytes());
+			digest.store(blob.data());
+
+			ok = ok
+				&& fwrite(&keySize,	sizeof keySize,		1, fp) == 1
+				&& fwrite(key.data(),	1, key.size(),		fp) == key.size()
+				&& fwrite(&capacity,	sizeof capacity,	1, fp) == 1
+				&& fwrite(&delta,	sizeof delta,		1, fp) == 1
+				&& fwrite(blob.data(),	1, blob.size(),		fp) == blob.size();
+		}
+
+		return fclose(fp) == 0 && ok;
+	}
+
+	void printQuantiles(Options const &options, Digests const &digests){
+		auto const &q = options.quantiles;
+
+		std::vector<double> out(q.size());
+
+		if (!options.keyColumn){
+			auto it = digests.find("");
+
+			if (it == digests.end())
+				return;
+
+			it->second.percentile(std::begin(q), std::end(q), std::begin(out));
+
+			printf("count\t%llu\n", (unsigned long long) it->second.weight());
+
+			for(size_t i = 0; i < q.size(); ++i)
+				printf("%g\t%.17g\n", q[i], out[i]);
+
+			return;
+		}
+
+		printf("key\tcount");
+		for(auto const &x : q)
+			printf("\t%g", x);
+		printf("\n");
+
+		for(auto const &[key, digest] : digests){
+			digest.percentile(std::begin(q), std::end(q), std::begin(out));
+
+			printf("%s\t%llu", key.c_str(), (unsigned long long) digest.weight());
+			for(auto const &x : out)
+				printf("\t%.17g", x);
+			printf("\n");
+		}
+	}
+
+	int usage(const char *name){
+		fprintf(stderr,
+			"Usage: %s [options] [file...]\n"
+			"\n"
+			"\t-f text|csv|binary\tinput format, default text - one number per line\n"
+			"\t-d delimiter\t\tcsv delimiter, default ,\n"
+			"\t-c column\t\tcsv value column, 1 based, default 1\n"
+			"\t-k column\t\tcsv key column, group by key\n"
+			"\t-q 0.5,0.99\t\tquantiles to print, default 0.5,0.9,0.99\n"
+			"\t-o file\t\t\twrite serialized digests instead\n"
+			"\t-n capacity\t\tcentroids per digest, default 100\n"
+			"\t-D delta\t\tcompression delta, default 0.01\n"
+			"\t-t threads\t\tdefault all cpus\n"
+			"\n"
+			"reads stdin, if there are no files.\n",
+			name);
+
+		return 1;
+	}
+
+	bool parseQuantiles(const char *s, std::vector<double> &quantiles){
+		std::string_view list{ s };
+
+		quantiles.clear();
+
+		while(!list.empty()){
+			auto const comma = list.find(',');
+
+			double q;
+
+			if (!parseDouble(trim(list.substr(0, comma)), q) || q < 0 || q > 1)
+				return false;
+
+			quantiles.push_back(q);
+
+			list.remove_prefix(comma == std::string_view::npos ? list.size() : comma + 1);
+		}
+
+		return !quantiles.empty();
+	}
+}
+
+int main(int argc, char **argv){
+	Options options;
+
+	for(int c; (c = getopt(argc, argv, "f:d:c:k:q:o:n:D:t:h")) != -1;){
+		switch(c){
+		case 'f':
+			if	(strcmp(optarg, "text"  ) == 0)	options.format = Format::TEXT;
+			else if	(strcmp(optarg, "csv"   ) == 0)	options.format = Format::CSV;
+			else if	(strcmp(optarg, "binary") == 0)	options.format = Format::BINARY;
+			else					return usage(argv[0]);
+
+			break;
+
+		case 'd': options.delimiter	= optarg[0];					break;
+		case 'c': options.column	= strtoul(optarg, nullptr, 10);			break;
+		case 'k': options.keyColumn	= strtoul(optarg, nullptr, 10);			break;
+		case 'o': options.output	= optarg;					break;
+		case 'n': options.capacity	= strtoul(optarg, nullptr, 10);			break;
+		case 'D': options.delta		= strtod(optarg, nullptr);			break;
+		case 't': options.threads	= strtoul(optarg, nullptr, 10);			break;
+
+		case 'q':
+			if (!parseQuantiles(optarg, options.quantiles))
+				return usage(argv[0]);
+
+			break;
+
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	if (options.keyColumn && options.format != Format::CSV){
+		fprintf(stderr, "key column needs csv input\n");
+		return 1;
+	}
+
+	if (options.column == 0 || options.capacity < 2)
+		return usage(argv[0]);
+
+	if (options.quantiles.empty())
+		options.quantiles = { 0.5, 0.9, 0.99 };
+
+	Aggregator aggregator{ options };
+
+	if (optind == argc){
+		if (!reportInput("stdin", readInput(STDIN_FILENO, options, aggregator)))
+			return 1;
+	}
+
+	for(int i = optind; i < argc; ++i){
+		int const fd = open(argv[i], O_RDONLY | O_CLOEXEC);
+
+		if (fd < 0){
+			perror(argv[i]);
+			return 1;
+		}
+
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+		auto const input = readInput(fd, options, aggregator);
+
+		close(fd);
+
+		if (!reportInput(argv[i], input))
+			return 1;
+	}
+
+	if (aggregator.bad())
+		fprintf(stderr, "%zu lines skipped\n", aggregator.bad());
+
+	if (options.output){
+		if (!writeDigests(options.output, aggregator.digests())){
+			perror(options.output);
+			return 1;
+		}
+
+		return 0;
+	}
+
+	printQuantiles(options, aggregator.digests());
+}
+
@@ -0,0 +1,112 @@
+#ifndef T_DIGEST_COMMON_H_
+#define T_DIGEST_COMMON_H_
+
+// internal - loops over the centroid blob, shared by RawTDigest,
+// its scalar kernels and RawIntTDigest.
+// Centroid needs operator bool, operator <, getWeight(), clear(),
+// create(value, weight) and print().
+
+#include <cstdint>
+#include <cstdio>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace tdigest_common{
+	template<typename Centroid>
+	void print(const Centroid *cd, size_t capacity){
+		printf("Centroids, capacity %zu\n", capacity);
+
+		for(size_t i = 0; i < capacity; ++i){
+			auto const &x = cd[i];
+			if (!x)
+				break;
+
+			x.print();
+		}
+	}
+
+	// total weight and size from i on, stops at the first empty centroid.
+	template<typename Centroid>
+	std::pair<uint64_t, size_t> weightAndSize(const Centroid *cd, size_t i, size_t capacity, uint64_t weight = 0){
+		for(; i < capacity; ++i){
+			if (!cd[i])
+				break;
+
+			weight += cd[i].getWeight();
+		}
+
+		return { weight, i };
+	}
+
+	// advance i / cumulative, until cd[i] reaches the target.
+	template<typename Centroid>
+	void crossing(const Centroid *cd, size_t &i, size_t size, uint64_t &cumulative, double target){
+		for(; i < size; ++i){
+			auto const c = cumulative + cd[i].getWeight();
+
+			if (static_cast<double>(c) >= target)
+				return;
+
+			cumulative = c;
+		}
+	}
+
+	// mean(Centroid const &) of the centroid, that reaches p of the weight.
+	// the last one, if nothing before it does
+	template<typename Centroid, typename Mean>
+	double percentile(const Centroid *cd, size_t size, uint64_t weight, double p, Mean mean){
+		if (size == 0)
+			return 0;
+
+		size_t   i		= 0;
+		uint64_t cumulative	= 0;
+
+		crossing(cd, i, size - 1, cumulative, p * static_cast<double>(weight));
+
+		return mean(cd[i]);
+	}
+
+	// run length encode the sorted values
+	template<typename T, typename Centroid>
+	void runLength(const T *values, size_t count, std::vector<Centroid> &run){
+		run.clear();
+
+		for(size_t i = 0; i < count; ){
+			size_t j = i + 1;
+			while(j < count && values[j] == values[i])
+				++j;
+
+			run.push_back(Centroid::create(values[i], j - i));
+
+			i = j;
+		}
+	}
+
+	// merge sorted src into the blob.
+	// compressToFit(Centroid *, size) brings the size down to capacity.
+	template<typename Centroid, typename CompressToFit>
+	void mergeSorted(Centroid *cd, size_t size, size_t capacity, const Centroid *src, size_t srcSize, CompressToFit compressToFit){
+		std::vector<Centroid> buffer;
+
+		// merge at most capacity centroids at once,
+		// so the buffer stays bounded.
+		while(srcSize){
+			auto const n = std::min(srcSize, capacity);
+
+			buffer.resize(size + n);
+			std::merge(cd, cd + size, src, src + n, buffer.data());
+
+			size = compressToFit(buffer.data(), size + n);
+
+			std::copy(buffer.data(), buffer.data() + size, cd);
+			if (size < capacity)
+				cd[size].clear();
+
+			src	+= n;
+			srcSize	-= n;
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,35 @@
+#include "tdigest_concurrent.h"
+
+#include <cstdlib>
+
+ConcurrentTDigest::ConcurrentTDigest(size_t capacity, double delta, double epsilon, size_t readers) :
+				td_(capacity, delta, epsilon),
+				epoch_(readers){
+	auto *cd = allocate_();
+	td_.clearFast(cd);
+
+	current_.store(cd);
+}
+
+ConcurrentTDigest::~ConcurrentTDigest(){
+	free(current_.load());
+	// retired blobs are freed by epoch_
+}
+
+auto ConcurrentTDigest::allocate_() const -> Centroid *{
+	return static_cast<Centroid *>(malloc(td_.bytes()));
+}
+
+void ConcurrentTDigest::publish_(Centroid *next){
+	auto *old = current_.exchange(next);
+
+	epoch_.retire(old, free);
+	epoch_.reclaim();
+}
+
+void ConcurrentTDigest::store(void *dest) const{
+	std::lock_guard lock{ mutex_ };
+
+	td_.store(current_.load(std::memory_order_relaxed), dest);
+}
+
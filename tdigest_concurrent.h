@@ -0,0 +1,171 @@
+#ifndef T_DIGEST_CONCURRENT_H_
+#define T_DIGEST_CONCURRENT_H_
+
+#include "tdigest.h"
+#include "epoch.h"
+
+#include <atomic>
+#include <mutex>
+#include <utility>	// exchange
+
+// Read optimized concurrent digest.
+//
+// writers copy the blob, change the copy and publish it (copy on write),
+// serialized by mutex. update() applies whole batch to single copy.
+// readers see immutable snapshot and never wait for writers.
+// old blobs are freed by epoch based reclamation.
+
+class ConcurrentTDigest{
+public:
+	using Centroid		= RawTDigest::Centroid;
+	using Compression	= RawTDigest::Compression;
+
+	class Reader;
+
+public:
+	ConcurrentTDigest(size_t capacity, double delta, double epsilon = 0.0, size_t readers = 64);
+
+	ConcurrentTDigest(ConcurrentTDigest const &) = delete;
+	ConcurrentTDigest &operator=(ConcurrentTDigest const &) = delete;
+
+	~ConcurrentTDigest();
+
+	RawTDigest const &raw() const{
+		return td_;
+	}
+
+public:
+	// f(RawTDigest const &, Centroid *) changes private copy of the blob
+	template<typename F>
+	void update(F f){
+		std::lock_guard lock{ mutex_ };
+
+		auto *next = allocate_();
+		td_.load(next, current_.load(std::memory_order_relaxed));
+
+		f(td_, next);
+
+		publish_(next);
+	}
+
+	template<Compression C = Compression::AGGRESSIVE>
+	void add(double value, uint64_t weight = 1){
+		update([&](RawTDigest const &td, Centroid *cd){
+			td.add<C>(cd, value, weight);
+		});
+	}
+
+	// values are sorted in place
+	void add(double *values, size_t count){
+		update([&](RawTDigest const &td, Centroid *cd){
+			td.add(cd, values, count);
+		});
+	}
+
+	// copy of the current snapshot
+	void store(void *dest) const;
+
+	Reader reader();
+
+private:
+	Centroid *allocate_() const;
+
+	void publish_(Centroid *next);
+
+private:
+	RawTDigest		td_;
+
+	std::atomic<Centroid *>	current_;
+
+	mutable std::mutex	mutex_;
+	mutable EpochDomain	epoch_;
+
+	friend class Reader;
+};
+
+
+
+// Reader handle, one per reader thread.
+// if all reader slots are taken, the handle reads under the writer mutex.
+
+class ConcurrentTDigest::Reader{
+public:
+	explicit Reader(ConcurrentTDigest &owner) :
+					owner_(&owner),
+					slot_(owner.epoch_.acquireSlot()){}
+
+	Reader(Reader &&other) noexcept :
+					owner_(other.owner_),
+					slot_(std::exchange(other.slot_, EpochDomain::NO_SLOT)){}
+
+	Reader(Reader const &) = delete;
+	Reader &operator=(Reader const &) = delete;
+	Reader &operator=(Reader &&) = delete;
+
+	~Reader(){
+		if (slot_ != EpochDomain::NO_SLOT)
+			owner_->epoch_.releaseSlot(slot_);
+	}
+
+	bool isWaitFree() const{
+		return slot_ != EpochDomain::NO_SLOT;
+	}
+
+	// f(RawTDigest const &, const Centroid *) sees immutable snapshot
+	template<typename F>
+	auto read(F f) const{
+		auto const &td = owner_->td_;
+
+		if (slot_ == EpochDomain::NO_SLOT){
+			std::lock_guard lock{ owner_->mutex_ };
+			return f(td, static_cast<const Centroid *>(owner_->current_.load()));
+		}
+
+		struct Pin{
+			EpochDomain	&epoch;
+			size_t		slot;
+
+			Pin(EpochDomain &epoch, size_t slot) : epoch(epoch), slot(slot){
+				epoch.pin(slot);
+			}
+
+			~Pin(){
+				epoch.unpin(slot);
+			}
+		} pin{ owner_->epoch_, slot_ };
+
+		return f(td, static_cast<const Centroid *>(owner_->current_.load()));
+	}
+
+	double percentile(double const p) const{
+		return read([p](RawTDigest const &td, const Centroid *cd){
+			return td.percentile(cd, p);
+		});
+	}
+
+	double percentile_50() const{
+		return percentile(0.50);
+	}
+
+	double percentile_95() const{
+		return percentile(0.95);
+	}
+
+	template<typename IT, typename OutIT>
+	void percentile(IT first, IT last, OutIT out) const{
+		read([&](RawTDigest const &td, const Centroid *cd){
+			td.percentile(cd, first, last, out);
+		});
+	}
+
+private:
+	ConcurrentTDigest	*owner_;
+	size_t			slot_;
+};
+
+inline auto ConcurrentTDigest::reader() -> Reader{
+	return Reader{ *this };
+}
+
+#endif
+
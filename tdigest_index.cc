@@ -0,0 +1,47 @@
+#include "tdigest_index.h"
+#include "tdigest_centroid.h"
+
+void TDigestIndex::build(RawTDigest const &td, const Centroid *cd){
+	means_.clear();
+
+	std::vector<double> cumulative;
+
+	weight_ = 0;
+
+	for(size_t i = 0; i < td.capacity(); ++i){
+		auto const &x = cd[i];
+		if (!x)
+			break;
+
+		weight_ += x.getWeight();
+
+		means_.push_back(x.getMean());
+		cumulative.push_back(static_cast<double>(weight_));
+	}
+
+	auto const n = means_.size();
+
+	eytMean_.resize(n + 1);
+	eytCumulative_.resize(n + 1);
+	position_.resize(n + 1);
+
+	size_t i = 0;
+
+	// in-order walk of the implicit tree
+	auto fill = [&](auto &fill, size_t k) -> void{
+		if (k > n)
+			return;
+
+		fill(fill, 2 * k);
+
+		eytMean_[k]		= means_[i];
+		eytCumulative_[k]	= cumulative[i];
+		position_[k]		= static_cast<uint32_t>(i);
+		++i;
+
+		fill(fill, 2 * k + 1);
+	};
+
+	fill(fill, 1);
+}
+
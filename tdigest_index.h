@@ -0,0 +1,104 @@
+#ifndef T_DIGEST_INDEX_H_
+#define T_DIGEST_INDEX_H_
+
+#include "tdigest.h"
+
+#include <cstdint>
+#include <vector>
+
+// same as std::lower_bound, but the loop has no data dependent branch,
+// the compare compiles to cmov.
+
+template<typename IT, typename T>
+IT lowerBoundBranchless(IT first, IT last, T const &value){
+	auto size = static_cast<size_t>(last - first);
+
+	if (size == 0)
+		return first;
+
+	while(size > 1){
+		auto const half = size / 2;
+
+		first += first[half - 1] < value ? half : 0;
+		size  -= half;
+	}
+
+	return first + (*first < value);
+}
+
+
+
+// Eytzinger layout search index over snapshot of the centroids.
+// the top levels of the tree share few cache lines
+// and the next levels are prefetched, while binary search
+// over 16 byte centroids misses the cache on almost every step.
+//
+// standalone structure, only bench uses it - RawTDigest keeps no state
+// per blob, so nothing rebuilds the index or searches it for insert
+// positions or percentiles. add() and compress() leave it stale,
+// build() it again after the blob changes.
+
+class TDigestIndex{
+public:
+	using Centroid = RawTDigest::Centroid;
+
+	TDigestIndex() = default;
+
+	TDigestIndex(RawTDigest const &td, const Centroid *cd){
+		build(td, cd);
+	}
+
+	void build(RawTDigest const &td, const Centroid *cd);
+
+	size_t size() const{
+		return means_.size();
+	}
+
+	uint64_t weight() const{
+		return weight_;
+	}
+
+	// same as lower_bound over the centroid means
+	size_t lowerBound(double value) const{
+		return search_(eytMean_, value);
+	}
+
+	double percentile(double const p) const{
+		if (size() == 0)
+			return 0;
+
+		auto const i = search_(eytCumulative_, p * static_cast<double>(weight_));
+
+		return means_[ std::min(i, size() - 1) ];
+	}
+
+private:
+	size_t search_(std::vector<double> const &eyt, double const value) const{
+		// 8 doubles per cache line, prefetch 4 levels ahead
+		constexpr size_t PREFETCH = 16;
+
+		auto const n = size();
+
+		size_t k = 1;
+		while(k <= n){
+			__builtin_prefetch(eyt.data() + PREFETCH * k);
+			k = 2 * k + (eyt[k] < value);
+		}
+
+		// go back to the last left turn
+		k >>= __builtin_ffsll(static_cast<long long>(~k));
+
+		return k ? position_[k] : n;
+	}
+
+private:
+	uint64_t		weight_ = 0;
+
+	std::vector<double>	means_;			// sorted
+	std::vector<double>	eytMean_;		// 1 based, Eytzinger order
+	std::vector<double>	eytCumulative_;		// 1 based, Eytzinger order
+	std::vector<uint32_t>	position_;		// Eytzinger -> sorted position
+};
+
+#endif
+
@@ -0,0 +1,123 @@
+#include "tdigest_ingest.h"
+
+#include <algorithm>	// min, max
+
+TDigestIngest::TDigestIngest(TDigestStore &store, IngestConfig const &config) :
+				store_(store),
+				config_(config),
+				ring_(config.queueCapacity),
+				batchSize_(config.minBatch){
+	assert(config_.minBatch && config_.minBatch <= config_.maxBatch);
+
+	batch_.reserve(config_.maxBatch);
+
+	tunedBatch_.store(batchSize_, std::memory_order_relaxed);
+
+	thread_ = std::thread{ &TDigestIngest::run_, this };
+}
+
+TDigestIngest::~TDigestIngest(){
+	stop_.store(true);
+	thread_.join();
+}
+
+bool TDigestIngest::tryAdd(std::string_view key, double value, uint64_t weight){
+	if (ring_.tryPush(Item{ std::string{ key }, value, weight }))
+		return true;
+
+	rejected_.fetch_add(1, std::memory_order_relaxed);
+
+	return false;
+}
+
+void TDigestIngest::add(std::string_view key, double value, uint64_t weight){
+	Item item{ std::string{ key }, value, weight };
+
+	if (ring_.tryPush(std::move(item)))
+		return;
+
+	stalls_.fetch_add(1, std::memory_order_relaxed);
+
+	// failed push does not touch the item
+	while(!ring_.tryPush(std::move(item)))
+		std::this_thread::yield();
+}
+
+void TDigestIngest::flush() const{
+	auto const pushed = ring_.pushed();
+
+	while(applied_.load(std::memory_order_acquire) < pushed)
+		std::this_thread::yield();
+}
+
+auto TDigestIngest::stats() const -> Stats{
+	Stats stats;
+
+	stats.applied		= applied_.load(std::memory_order_relaxed);
+	stats.batches		= batches_.load(std::memory_order_relaxed);
+	stats.rejected		= rejected_.load(std::memory_order_relaxed);
+	stats.stalls		= stalls_.load(std::memory_order_relaxed);
+	stats.batchSize		= tunedBatch_.load(std::memory_order_relaxed);
+	stats.lastDrainNs	= lastDrainNs_.load(std::memory_order_relaxed);
+	stats.maxDrainNs	= maxDrainNs_.load(std::memory_order_relaxed);
+	stats.totalDrainNs	= totalDrainNs_.load(std::memory_order_relaxed);
+
+	return stats;
+}
+
+void TDigestIngest::run_(){
+	using clock = std::chrono::steady_clock;
+
+	for(;;){
+		// stop is checked before the drain, so last push is never missed
+		bool const stop = stop_.load();
+
+		auto const start = clock::now();
+
+		auto const count = drain_();
+
+		if (count == 0){
+			if (stop)
+				return;
+
+			std::this_thread::sleep_for(config_.idleSleep);
+			continue;
+		}
+
+		{
+			std::lock_guard lock{ storeMutex_ };
+			store_.add(batch_.data(), batch_.size());
+		}
+
+		auto const ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count());
+
+		batches_.fetch_add(1, std::memory_order_relaxed);
+		lastDrainNs_.store(ns, std::memory_order_relaxed);
+		totalDrainNs_.fetch_add(ns, std::memory_order_relaxed);
+
+		if (ns > maxDrainNs_.load(std::memory_order_relaxed))
+			maxDrainNs_.store(ns, std::memory_order_relaxed);
+
+		applied_.store(ring_.popped(), std::memory_order_release);
+
+		// tune the batch size
+		if (count == batchSize_)
+			batchSize_ = std::min(batchSize_ * 2, config_.maxBatch);
+		else if (count < batchSize_ / 2)
+			batchSize_ = std::max(batchSize_ / 2, config_.minBatch);
+
+		tunedBatch_.store(batchSize_, std::memory_order_relaxed);
+	}
+}
+
+size_t TDigestIngest::drain_(){
+	batch_.clear();
+
+	Item item;
+
+	while(batch_.size() < batchSize_ && ring_.tryPop(item))
+		batch_.push_back(std::move(item));
+
+	return batch_.size();
+}
+
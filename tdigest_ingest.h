@@ -0,0 +1,111 @@
+#ifndef T_DIGEST_INGEST_H_
+#define T_DIGEST_INGEST_H_
+
+#include "tdigest_store.h"
+#include "mpsc_ring.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Batched ingestion into keyed store.
+//
+// producers push (key, value, weight) into lock-free ring,
+// single owner thread drains it in batches, groups by key
+// and applies the batch with single batched add per key.
+//
+// batch size is tuned between minBatch and maxBatch -
+// full drain doubles it, drain below half of it halves it.
+
+struct IngestConfig{
+	size_t				queueCapacity	= 1 << 16;	// power of 2
+	size_t				minBatch	= 64;
+	size_t				maxBatch	= 8192;
+	std::chrono::microseconds	idleSleep	{ 100 };
+};
+
+class TDigestIngest{
+public:
+	struct Stats{
+		uint64_t	applied		= 0;
+		uint64_t	batches		= 0;
+		uint64_t	rejected	= 0;	// tryAdd() on full queue
+		uint64_t	stalls		= 0;	// add() waited for space
+		size_t		batchSize	= 0;
+
+		// batch drain + apply time
+		uint64_t	lastDrainNs	= 0;
+		uint64_t	maxDrainNs	= 0;
+		uint64_t	totalDrainNs	= 0;
+	};
+
+public:
+	explicit TDigestIngest(TDigestStore &store, IngestConfig const &config = {});
+
+	TDigestIngest(TDigestIngest const &) = delete;
+	TDigestIngest &operator=(TDigestIngest const &) = delete;
+
+	// applies everything pushed so far
+	~TDigestIngest();
+
+	// false if the queue is full
+	bool tryAdd(std::string_view key, double value, uint64_t weight = 1);
+
+	// waits for space
+	void add(std::string_view key, double value, uint64_t weight = 1);
+
+	// waits until everything pushed so far is applied
+	void flush() const;
+
+	// pushed, not applied yet
+	size_t backlog() const{
+		return ring_.pushed() - applied_.load(std::memory_order_acquire);
+	}
+
+	// f(TDigestStore &), between the batches
+	template<typename F>
+	auto read(F f){
+		std::lock_guard lock{ storeMutex_ };
+		return f(store_);
+	}
+
+	Stats stats() const;
+
+private:
+	using Item = TDigestStore::Sample;
+
+	void run_();
+
+	size_t drain_();
+
+private:
+	TDigestStore			&store_;
+	IngestConfig			config_;
+
+	MPSCRing<Item>			ring_;
+
+	std::mutex			storeMutex_;
+
+	// owner thread only
+	std::vector<Item>		batch_;
+	size_t				batchSize_;
+
+	std::atomic<size_t>		applied_	{ 0 };
+	std::atomic<bool>		stop_		{ false };
+
+	std::atomic<uint64_t>		rejected_	{ 0 };
+	std::atomic<uint64_t>		stalls_		{ 0 };
+	std::atomic<uint64_t>		batches_	{ 0 };
+	std::atomic<size_t>		tunedBatch_	{ 0 };
+	std::atomic<uint64_t>		lastDrainNs_	{ 0 };
+	std::atomic<uint64_t>		maxDrainNs_	{ 0 };
+	std::atomic<uint64_t>		totalDrainNs_	{ 0 };
+
+	std::thread			thread_;
+};
+
+#endif
+
@@ -0,0 +1,256 @@
+#include "tdigest_int.h"
+#include "tdigest_common.h"
+#include "radixsort.h"
+
+#include <limits>
+#include <vector>
+#include <cstdio>
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+
+
+struct RawIntTDigest::Centroid{
+	uint128_t sum_;
+	uint64_t  weight_;
+	uint64_t  mean_;	// sum_ / weight_, cached for integer compares
+
+	constexpr static auto create(uint64_t value, uint64_t weight){
+		return Centroid{ uint128_t{ value } * weight, weight, value };
+	}
+
+	constexpr void clear(){
+		sum_    = 0;
+		weight_ = 0;
+		mean_   = 0;
+	}
+
+	constexpr auto getMean() const{
+		return mean_;
+	}
+
+	constexpr auto getWeight() const{
+		return weight_;
+	}
+
+	constexpr operator bool() const{
+		return weight_;
+	}
+
+	constexpr double getExactMean() const{
+		return static_cast<double>(sum_) / static_cast<double>(weight_);
+	}
+
+	constexpr void merge(Centroid const &other){
+		sum_    += other.sum_;
+		weight_ += other.weight_;
+		mean_    = static_cast<uint64_t>(sum_ / weight_);
+	}
+
+	void print() const{
+		printf("> Addr %p | mean: %10.4f | weight: %5zu\n", (void *) this, getExactMean(), getWeight());
+	}
+
+	friend constexpr bool operator<(Centroid const &a, Centroid const &b){
+		return a.getMean() < b.getMean();
+	}
+};
+
+static_assert(std::is_trivial_v<RawIntTDigest::Centroid>);
+
+const size_t RawIntTDigest::sizeof_Centroid__ = sizeof(RawIntTDigest::Centroid);
+
+
+
+namespace{
+	using Centroid = RawIntTDigest::Centroid;
+
+	constexpr uint64_t distance(uint64_t a, uint64_t b){
+		return a > b ? a - b : b - a;
+	}
+
+	template<bool UseWeight>
+	size_t compressCentroids(Centroid *cd, size_t size, uint64_t delta){
+		assert(size > 1);
+
+		size_t newSize = 0;
+		auto   current = cd[0];
+
+		for (size_t i = 1; i < size; ++i){
+			uint128_t const d = distance(cd[i].getMean(), current.getMean());
+
+			uint128_t const weight = UseWeight ? current.getWeight() + cd[i].getWeight() : 1;
+
+			if (weight * d <= delta) {
+				current.merge(cd[i]);
+			}else{
+				cd[newSize++] = current;
+				current = cd[i];
+			}
+		}
+
+		cd[newSize++] = current;
+
+		return newSize;
+	}
+
+	uint64_t findMinDistance(const Centroid *cd, size_t const size){
+		assert(size > 1);
+
+		uint64_t minDistance = std::numeric_limits<uint64_t>::max();
+
+		for(auto it = cd; it != cd + size - 1; ++it)
+			minDistance = std::min(minDistance, distance(it->getMean(), std::next(it)->getMean()));
+
+		return minDistance;
+	}
+}
+
+
+
+void RawIntTDigest::print(const Centroid *cd) const{
+	tdigest_common::print(cd, capacity());
+}
+
+
+
+size_t RawIntTDigest::getSize_(const Centroid *cd) const{
+	return tdigest_common::weightAndSize(cd, 0, capacity()).second;
+}
+
+std::pair<uint64_t, size_t> RawIntTDigest::getWeightAndSize_(const Centroid *cd) const{
+	return tdigest_common::weightAndSize(cd, 0, capacity());
+}
+
+double RawIntTDigest::percentile_(const Centroid *cd, size_t size, uint64_t weight, double const p) const{
+	return tdigest_common::percentile(cd, size, weight, p, [](Centroid const &x){
+		return x.getExactMean();
+	});
+}
+
+
+
+bool RawIntTDigest::place_(Centroid *cd, size_t &size, Centroid const &item) const{
+	auto it = std::lower_bound(cd, cd + size, item);
+
+	if (it != cd + size && it->getMean() == item.getMean()){
+		it->merge(item);
+		return true;
+	}
+
+	if (size == capacity())
+		return false;
+
+	std::move_backward(it, cd + size, cd + size + 1);
+	*it = item;
+
+	if (++size < capacity())
+		cd[size].clear();
+
+	return true;
+}
+
+template<RawIntTDigest::Compression C>
+void RawIntTDigest::add(Centroid *cd, uint64_t value, uint64_t weight) const{
+	assert(weight > 0);
+
+	auto size = getSize_(cd);
+
+	auto const item = Centroid::create(value, weight);
+
+	if (place_(cd, size, item))
+		return;
+
+	if constexpr(C == Compression::NONE)
+		return;
+
+	if constexpr(C == Compression::STANDARD)
+		size = compressNormal_(cd, size);
+
+	if constexpr(C == Compression::AGGRESSIVE)
+		size = compressAggressive_(cd, size);
+
+	if (place_(cd, size, item))
+		return;
+
+	// drop the value
+}
+
+template void RawIntTDigest::add<RawIntTDigest::Compression::NONE	>(Centroid *cd, uint64_t value, uint64_t weight) const;
+template void RawIntTDigest::add<RawIntTDigest::Compression::STANDARD	>(Centroid *cd, uint64_t value, uint64_t weight) const;
+template void RawIntTDigest::add<RawIntTDigest::Compression::AGGRESSIVE	>(Centroid *cd, uint64_t value, uint64_t weight) const;
+
+void RawIntTDigest::add(Centroid *cd, uint64_t *values, size_t count) const{
+	if (count == 0)
+		return;
+
+	{
+		std::vector<uint64_t> buffer(count);
+		radixSort(values, values + count, buffer.data(), [](uint64_t x){ return x; });
+	}
+
+	std::vector<Centroid> run;
+	tdigest_common::runLength(values, count, run);
+
+	mergeSorted_(cd, getSize_(cd), run.data(), run.size());
+}
+
+void RawIntTDigest::merge(Centroid *cd, const Centroid *src) const{
+	mergeSorted_(cd, getSize_(cd), src, getSize_(src));
+}
+
+void RawIntTDigest::mergeSorted_(Centroid *cd, size_t size, const Centroid *src, size_t srcSize) const{
+	tdigest_common::mergeSorted(cd, size, capacity(), src, srcSize, [this](Centroid *buffer, size_t count){
+		return compressToFit_(buffer, count);
+	});
+}
+
+
+
+size_t RawIntTDigest::compressNormal_(Centroid *cd, size_t size) const{
+	if (size < 2)
+		return size;
+
+	size = compressCentroids<1>(cd, size, delta_);
+
+	if (size < capacity())
+		cd[size].clear();
+
+	return size;
+}
+
+size_t RawIntTDigest::compressAggressive_(Centroid *cd, size_t size) const{
+	if (size < 2)
+		return size;
+
+	auto const distance = findMinDistance(cd, size);
+
+	if (distance > delta_)
+		size = compressCentroids<0>(cd, size, distance);
+	else
+		size = compressCentroids<1>(cd, size, delta_);
+
+	if (size < capacity())
+		cd[size].clear();
+
+	return size;
+}
+
+size_t RawIntTDigest::compressToFit_(Centroid *cd, size_t size) const{
+	if (size < 2)
+		return size;
+
+	// same integer mean first - floored means, so the exact means
+	// differ by less than 1, the cheapest merges there are
+	size = compressCentroids<0>(cd, size, 0);
+
+	if (size > capacity())
+		size = compressCentroids<1>(cd, size, delta_);
+
+	// each pass merges at least the closest pair
+	while(size > capacity())
+		size = compressCentroids<0>(cd, size, findMinDistance(cd, size));
+
+	return size;
+}
+
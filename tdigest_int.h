@@ -0,0 +1,120 @@
+#ifndef T_DIGEST_INT_H_
+#define T_DIGEST_INT_H_
+
+#include "tdigest.h"
+
+#include <cstdint>
+#include <cassert>
+#include <cstring>
+#include <algorithm>	// transform
+
+// T-Digest over integer samples (microseconds, byte counts).
+// centroids keep exact 128 bit sums,
+// so merged means are exact and doubles are produced only on query.
+
+class RawIntTDigest{
+	size_t		capacity_;
+	uint64_t	delta_;
+
+	static const size_t sizeof_Centroid__;
+
+public:
+	struct Centroid;
+
+	using Compression = RawTDigest::Compression;
+
+public:
+	constexpr RawIntTDigest(size_t capacity, uint64_t delta) : capacity_(capacity), delta_(delta){
+		assert(capacity_ >= 2);
+	}
+
+	constexpr size_t capacity() const{
+		return capacity_;
+	}
+
+	constexpr size_t bytes() const{
+		return capacity_ * sizeof_Centroid__;
+	}
+
+	void print(const Centroid *cd) const;
+
+public:
+	static void clearFast(Centroid *cd){
+		memset(cd, 0, sizeof_Centroid__);
+	}
+
+	void clear(Centroid *cd) const{
+		memset(cd, 0, bytes());
+	}
+
+	void load(Centroid *cd, const void *src) const{
+		memcpy(cd, src, bytes());
+	}
+
+	void store(const Centroid *cd, void *dest) const{
+		memcpy(dest, cd, bytes());
+	}
+
+public:
+	template<Compression C = Compression::AGGRESSIVE>
+	void add(Centroid *cd, uint64_t value, uint64_t weight = 1) const;
+
+	// values are sorted in place
+	void add(Centroid *cd, uint64_t *values, size_t count) const;
+
+	void merge(Centroid *cd, const Centroid *src) const;
+
+	size_t compress(Centroid *cd) const{
+		size_t const size = getSize_(cd);
+
+		return compressNormal_(cd, size);
+	}
+
+	double percentile_50(const Centroid *cd) const{
+		return percentile(cd, 0.50);
+	}
+
+	double percentile_95(const Centroid *cd) const{
+		return percentile(cd, 0.95);
+	}
+
+	double percentile(const Centroid *cd, double const p) const{
+		assert(p >= 0.00 && p <= 1.00);
+
+		auto [weight, size] = getWeightAndSize_(cd);
+
+		return percentile_(cd, size, weight, p);
+	}
+
+	template<typename IT, typename OutIT>
+	void percentile(const Centroid *cd, IT first, IT last, OutIT out) const{
+		auto [weight, size] = getWeightAndSize_(cd);
+
+		auto f = [&](double p){
+			assert(p >= 0.00 && p <= 1.00);
+			return percentile_(cd, size, weight, p);
+		};
+
+		std::transform(first, last, out, f);
+	}
+
+private:
+	size_t getSize_(const Centroid *cd) const;
+
+	std::pair<uint64_t, size_t> getWeightAndSize_(const Centroid *cd) const;
+
+	double percentile_(const Centroid *cd, size_t size, uint64_t weight, double const p) const;
+
+	bool place_(Centroid *cd, size_t &size, Centroid const &item) const;
+
+	void mergeSorted_(Centroid *cd, size_t size, const Centroid *src, size_t srcSize) const;
+
+	size_t compressNormal_(Centroid *cd, size_t size) const;
+
+	size_t compressAggressive_(Centroid *cd, size_t size) const;
+
+	size_t compressToFit_(Centroid *cd, size_t size) const;
+};
+
+#endif
+
@@ -0,0 +1,434 @@
+#include "tdigest_kernel.h"
+#include "tdigest_centroid.h"
+#include "tdigest_common.h"
+
+#include <immintrin.h>
+
+namespace{
+	using Centroid		= RawTDigest::Centroid;
+	using WeightAndSize	= std::pair<uint64_t, size_t>;
+	using WeightedSum	= std::pair<double, uint64_t>;
+
+	static_assert(sizeof(Centroid) == 2 * sizeof(uint64_t));
+
+	// centroid is { mean, weight },
+	// so unpackhi of two registers collects the weights.
+
+	template<typename T>
+	const T *ptr(const Centroid *cd){
+		return reinterpret_cast<const T *>(cd);
+	}
+
+	using tdigest_common::crossing;
+
+	WeightAndSize weightAndSizeTail(const Centroid *cd, size_t i, size_t capacity, uint64_t weight){
+		return tdigest_common::weightAndSize(cd, i, capacity, weight);
+	}
+
+
+
+	WeightedSum weightedSumTail(const Centroid *cd, size_t i, size_t size, double sum, uint64_t weight){
+		for(; i < size; ++i){
+			sum    += cd[i].getWeightedMean();
+			weight += cd[i].getWeight();
+		}
+
+		return { sum, weight };
+	}
+
+	// exact for weights below 2^52:
+	// weight bits or-ed into mantissa of 2^52, then 2^52 subtracted.
+	// kernels check the limit and fall back to scalar above it.
+	constexpr uint64_t MAGIC_BITS	= 0x4330000000000000;
+	constexpr double   MAGIC	= 4503599627370496.0;
+	constexpr uint64_t MAGIC_LIMIT	= uint64_t{ 1 } << 52;
+
+	// first i, that closes the group started at mean,
+	// weight is the group weight before i.
+	size_t groupEndTail(const Centroid *cd, size_t i, size_t size, double mean, uint64_t weight, double delta, bool useWeight){
+		for(; i < size; ++i){
+			weight += cd[i].getWeight();
+
+			auto const factor = useWeight ? static_cast<double>(weight) : 1.0;
+
+			if (!(factor * (cd[i].getMean() - mean) <= delta))
+				return i;
+		}
+
+		return size;
+	}
+
+
+
+	WeightAndSize weightAndSizeScalar(const Centroid *cd, size_t capacity){
+		return weightAndSizeTail(cd, 0, capacity, 0);
+	}
+
+	void rankCrossingScalar(const Centroid *cd, size_t size, const double *ranks, size_t count, size_t *out){
+		size_t   i		= 0;
+		uint64_t cumulative	= 0;
+
+		for(size_t t = 0; t < count; ++t){
+			crossing(cd, i, size, cumulative, ranks[t]);
+			out[t] = i;
+		}
+	}
+
+
+
+	WeightedSum weightedSumScalar(const Centroid *cd, size_t size){
+		return weightedSumTail(cd, 0, size, 0, 0);
+	}
+
+	size_t groupEndScalar(const Centroid *cd, size_t start, size_t size, double delta, bool useWeight){
+		return groupEndTail(cd, start + 1, size, cd[start].getMean(), cd[start].getWeight(), delta, useWeight);
+	}
+
+
+
+	__attribute__((target("sse4.2")))
+	WeightAndSize weightAndSizeSSE42(const Centroid *cd, size_t capacity){
+		constexpr size_t B = 2;
+
+		auto const zero = _mm_setzero_si128();
+		auto acc = _mm_setzero_si128();
+
+		size_t i = 0;
+		for(; i + B <= capacity; i += B){
+			auto const a = _mm_loadu_si128(ptr<__m128i>(cd + i    ));
+			auto const b = _mm_loadu_si128(ptr<__m128i>(cd + i + 1));
+			auto const w = _mm_unpackhi_epi64(a, b);
+
+			if (_mm_movemask_epi8(_mm_cmpeq_epi64(w, zero)))
+				break;
+
+			acc = _mm_add_epi64(acc, w);
+		}
+
+		uint64_t const weight = static_cast<uint64_t>(_mm_extract_epi64(acc, 0) + _mm_extract_epi64(acc, 1));
+
+		return weightAndSizeTail(cd, i, capacity, weight);
+	}
+
+	__attribute__((target("sse4.2")))
+	void rankCrossingSSE42(const Centroid *cd, size_t size, const double *ranks, size_t count, size_t *out){
+		constexpr size_t B = 2;
+
+		size_t   i		= 0;
+		uint64_t cumulative	= 0;
+
+		for(size_t t = 0; t < count; ++t){
+			for(; i + B <= size; i += B){
+				auto const a = _mm_loadu_si128(ptr<__m128i>(cd + i    ));
+				auto const b = _mm_loadu_si128(ptr<__m128i>(cd + i + 1));
+				auto const w = _mm_unpackhi_epi64(a, b);
+				auto const s = _mm_add_epi64(w, _mm_unpackhi_epi64(w, w));
+
+				auto const c = cumulative + static_cast<uint64_t>(_mm_cvtsi128_si64(s));
+
+				if (static_cast<double>(c) >= ranks[t])
+					break;
+
+				cumulative = c;
+			}
+
+			crossing(cd, i, size, cumulative, ranks[t]);
+			out[t] = i;
+		}
+	}
+
+
+
+	__attribute__((target("avx2")))
+	uint64_t hsum(__m256i x){
+		auto const s = _mm_add_epi64(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+
+		return static_cast<uint64_t>(_mm_cvtsi128_si64(_mm_add_epi64(s, _mm_unpackhi_epi64(s, s))));
+	}
+
+	__attribute__((target("avx2")))
+	WeightAndSize weightAndSizeAVX2(const Centroid *cd, size_t capacity){
+		constexpr size_t B = 4;
+
+		auto const zero = _mm256_setzero_si256();
+		auto acc = _mm256_setzero_si256();
+
+		size_t i = 0;
+		for(; i + B <= capacity; i += B){
+			auto const a = _mm256_loadu_si256(ptr<__m256i>(cd + i    ));
+			auto const b = _mm256_loadu_si256(ptr<__m256i>(cd + i + 2));
+			auto const w = _mm256_unpackhi_epi64(a, b);
+
+			if (_mm256_movemask_epi8(_mm256_cmpeq_epi64(w, zero)))
+				break;
+
+			acc = _mm256_add_epi64(acc, w);
+		}
+
+		return weightAndSizeTail(cd, i, capacity, hsum(acc));
+	}
+
+	__attribute__((target("avx2")))
+	void rankCrossingAVX2(const Centroid *cd, size_t size, const double *ranks, size_t count, size_t *out){
+		constexpr size_t B = 4;
+
+		size_t   i		= 0;
+		uint64_t cumulative	= 0;
+
+		for(size_t t = 0; t < count; ++t){
+			for(; i + B <= size; i += B){
+				auto const a = _mm256_loadu_si256(ptr<__m256i>(cd + i    ));
+				auto const b = _mm256_loadu_si256(ptr<__m256i>(cd + i + 2));
+
+				auto const c = cumulative + hsum(_mm256_unpackhi_epi64(a, b));
+
+				if (static_cast<double>(c) >= ranks[t])
+					break;
+
+				cumulative = c;
+			}
+
+			crossing(cd, i, size, cumulative, ranks[t]);
+			out[t] = i;
+		}
+	}
+
+
+
+	__attribute__((target("avx2")))
+	WeightedSum weightedSumAVX2(const Centroid *cd, size_t size){
+		constexpr size_t B = 4;
+
+		auto const magicBits	= _mm256_set1_epi64x(MAGIC_BITS);
+		auto const magic	= _mm256_set1_pd(MAGIC);
+
+		auto accSum	= _mm256_setzero_pd();
+		auto accWeight	= _mm256_setzero_si256();
+		auto accBits	= _mm256_setzero_si256();
+
+		size_t i = 0;
+		for(; i + B <= size; i += B){
+			auto const a = _mm256_loadu_si256(ptr<__m256i>(cd + i    ));
+			auto const b = _mm256_loadu_si256(ptr<__m256i>(cd + i + 2));
+
+			auto const m = _mm256_castsi256_pd(_mm256_unpacklo_epi64(a, b));
+			auto const w = _mm256_unpackhi_epi64(a, b);
+
+			auto const wd = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(w, magicBits)), magic);
+
+			accSum		= _mm256_add_pd(accSum, _mm256_mul_pd(m, wd));
+			accWeight	= _mm256_add_epi64(accWeight, w);
+			accBits		= _mm256_or_si256(accBits, w);
+		}
+
+		if (!_mm256_testz_si256(accBits, _mm256_set1_epi64x(-static_cast<int64_t>(MAGIC_LIMIT))))
+			return weightedSumScalar(cd, size);
+
+		alignas(32) double s[4];
+		_mm256_store_pd(s, accSum);
+
+		return weightedSumTail(cd, i, size, (s[0] + s[1]) + (s[2] + s[3]), hsum(accWeight));
+	}
+
+	__attribute__((target("avx2")))
+	size_t groupEndAVX2(const Centroid *cd, size_t start, size_t size, double delta, bool useWeight){
+		constexpr size_t B = 4;
+
+		auto const mean		= cd[start].getMean();
+		uint64_t   weight	= cd[start].getWeight();
+
+		auto const magicBits	= _mm256_set1_epi64x(MAGIC_BITS);
+		auto const magic	= _mm256_set1_pd(MAGIC);
+		auto const meanV	= _mm256_set1_pd(mean);
+		auto const deltaV	= _mm256_set1_pd(delta);
+		auto const one		= _mm256_set1_pd(1.0);
+		auto const zero		= _mm256_setzero_si256();
+
+		size_t i = start + 1;
+		for(; i + B <= size; i += B){
+			auto const a = _mm256_loadu_si256(ptr<__m256i>(cd + i    ));
+			auto const b = _mm256_loadu_si256(ptr<__m256i>(cd + i + 2));
+
+			// unpack gives 0, 2, 1, 3 order
+			auto const m = _mm256_castsi256_pd(_mm256_permute4x64_epi64(_mm256_unpacklo_epi64(a, b), 0xD8));
+			auto       w = _mm256_permute4x64_epi64(_mm256_unpackhi_epi64(a, b), 0xD8);
+
+			// prefix sums of the weights, in two shifted adds
+			w = _mm256_add_epi64(w, _mm256_blend_epi32(_mm256_permute4x64_epi64(w, 0x90), zero, 0x03));
+			w = _mm256_add_epi64(w, _mm256_blend_epi32(_mm256_permute4x64_epi64(w, 0x40), zero, 0x0F));
+			w = _mm256_add_epi64(w, _mm256_set1_epi64x(static_cast<int64_t>(weight)));
+
+			auto const total = static_cast<uint64_t>(_mm256_extract_epi64(w, 3));
+
+			if (total >= MAGIC_LIMIT)
+				break;
+
+			auto const factor = useWeight ? _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(w, magicBits)), magic) : one;
+
+			auto const over = _mm256_cmp_pd(_mm256_mul_pd(factor, _mm256_sub_pd(m, meanV)), deltaV, _CMP_NLE_UQ);
+
+			if (auto const mask = _mm256_movemask_pd(over))
+				return i + static_cast<size_t>(__builtin_ctz(static_cast<unsigned>(mask)));
+
+			weight = total;
+		}
+
+		return groupEndTail(cd, i, size, mean, weight, delta, useWeight);
+	}
+
+
+
+	// maskz forms, plain forms trip -Wuninitialized in gcc 12 headers
+
+	__attribute__((target("avx512f")))
+	__m512i unpackhi(__m512i a, __m512i b){
+		return _mm512_maskz_unpackhi_epi64(0xFF, a, b);
+	}
+
+	__attribute__((target("avx512f")))
+	uint64_t hsum(__m512i x){
+		return hsum(_mm256_add_epi64(_mm512_maskz_extracti64x4_epi64(0xF, x, 0), _mm512_maskz_extracti64x4_epi64(0xF, x, 1)));
+	}
+
+	__attribute__((target("avx512f")))
+	WeightAndSize weightAndSizeAVX512(const Centroid *cd, size_t capacity){
+		constexpr size_t B = 8;
+
+		auto const zero = _mm512_setzero_si512();
+		auto acc = _mm512_setzero_si512();
+
+		size_t i = 0;
+		for(; i + B <= capacity; i += B){
+			auto const a = _mm512_loadu_si512(cd + i    );
+			auto const b = _mm512_loadu_si512(cd + i + 4);
+			auto const w = unpackhi(a, b);
+
+			if (_mm512_cmpeq_epi64_mask(w, zero))
+				break;
+
+			acc = _mm512_add_epi64(acc, w);
+		}
+
+		return weightAndSizeTail(cd, i, capacity, hsum(acc));
+	}
+
+	__attribute__((target("avx512f")))
+	void rankCrossingAVX512(const Centroid *cd, size_t size, const double *ranks, size_t count, size_t *out){
+		constexpr size_t B = 8;
+
+		size_t   i		= 0;
+		uint64_t cumulative	= 0;
+
+		for(size_t t = 0; t < count; ++t){
+			for(; i + B <= size; i += B){
+				auto const a = _mm512_loadu_si512(cd + i    );
+				auto const b = _mm512_loadu_si512(cd + i + 4);
+
+				auto const c = cumulative + hsum(unpackhi(a, b));
+
+				if (static_cast<double>(c) >= ranks[t])
+					break;
+
+				cumulative = c;
+			}
+
+			crossing(cd, i, size, cumulative, ranks[t]);
+			out[t] = i;
+		}
+	}
+
+
+
+	__attribute__((target("avx512f")))
+	WeightedSum weightedSumAVX512(const Centroid *cd, size_t size){
+		constexpr size_t B = 8;
+
+		auto const magicBits	= _mm512_set1_epi64(MAGIC_BITS);
+		auto const magic	= _mm512_set1_pd(MAGIC);
+
+		auto accSum	= _mm512_setzero_pd();
+		auto accWeight	= _mm512_setzero_si512();
+		auto accBits	= _mm512_setzero_si512();
+
+		size_t i = 0;
+		for(; i + B <= size; i += B){
+			auto const a = _mm512_loadu_si512(cd + i    );
+			auto const b = _mm512_loadu_si512(cd + i + 4);
+
+			auto const m = _mm512_castsi512_pd(_mm512_maskz_unpacklo_epi64(0xFF, a, b));
+			auto const w = unpackhi(a, b);
+
+			auto const wd = _mm512_sub_pd(_mm512_castsi512_pd(_mm512_or_si512(w, magicBits)), magic);
+
+			accSum		= _mm512_fmadd_pd(m, wd, accSum);
+			accWeight	= _mm512_add_epi64(accWeight, w);
+			accBits		= _mm512_or_si512(accBits, w);
+		}
+
+		if (_mm512_test_epi64_mask(accBits, _mm512_set1_epi64(-static_cast<int64_t>(MAGIC_LIMIT))))
+			return weightedSumScalar(cd, size);
+
+		alignas(64) double s[8];
+		_mm512_store_pd(s, accSum);
+
+		double const sum = ((s[0] + s[1]) + (s[2] + s[3])) + ((s[4] + s[5]) + (s[6] + s[7]));
+
+		return weightedSumTail(cd, i, size, sum, hsum(accWeight));
+	}
+
+
+
+	struct Kernel{
+		WeightAndSize	(*weightAndSize)(const Centroid *cd, size_t capacity);
+		void		(*rankCrossing)(const Centroid *cd, size_t size, const double *ranks, size_t count, size_t *out);
+		WeightedSum	(*weightedSum)(const Centroid *cd, size_t size);
+		size_t		(*groupEnd)(const Centroid *cd, size_t start, size_t size, double delta, bool useWeight);
+		const char	*name;
+	};
+
+	Kernel selectKernel(){
+		__builtin_cpu_init();
+
+		if (__builtin_cpu_supports("avx512f"))
+			return { weightAndSizeAVX512,	rankCrossingAVX512,	weightedSumAVX512,	groupEndAVX2,	"avx512"	};
+
+		if (__builtin_cpu_supports("avx2"))
+			return { weightAndSizeAVX2,	rankCrossingAVX2,	weightedSumAVX2,	groupEndAVX2,	"avx2"		};
+
+		// two doubles per register do not pay for the conversion
+		if (__builtin_cpu_supports("sse4.2"))
+			return { weightAndSizeSSE42,	rankCrossingSSE42,	weightedSumScalar,	groupEndScalar,	"sse4.2"	};
+
+		return { weightAndSizeScalar,	rankCrossingScalar,	weightedSumScalar,	groupEndScalar,	"scalar"	};
+	}
+
+	Kernel const &kernel(){
+		static Kernel const k = selectKernel();
+		return k;
+	}
+}
+
+
+
+namespace tdigest_kernel{
+	std::pair<uint64_t, size_t> weightAndSize(const Centroid *cd, size_t capacity){
+		return kernel().weightAndSize(cd, capacity);
+	}
+
+	void rankCrossing(const Centroid *cd, size_t size, const double *ranks, size_t count, size_t *out){
+		return kernel().rankCrossing(cd, size, ranks, count, out);
+	}
+
+	std::pair<double, uint64_t> weightedSum(const Centroid *cd, size_t size){
+		return kernel().weightedSum(cd, size);
+	}
+
+	size_t groupEnd(const Centroid *cd, size_t start, size_t size, double delta, bool useWeight){
+		return kernel().groupEnd(cd, start, size, delta, useWeight);
+	}
+
+	const char *name(){
+		return kernel().name;
+	}
+}
+
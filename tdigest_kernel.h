@@ -0,0 +1,36 @@
+#ifndef T_DIGEST_KERNEL_H_
+#define T_DIGEST_KERNEL_H_
+
+// internal - scan kernels over the centroid blob,
+// selected once at runtime by CPU features (AVX-512, AVX2, SSE4.2, scalar).
+
+#include "tdigest.h"
+
+#include <cstdint>
+#include <utility>
+
+namespace tdigest_kernel{
+	using Centroid = RawTDigest::Centroid;
+
+	// total weight and size, stops at the first empty centroid.
+	std::pair<uint64_t, size_t> weightAndSize(const Centroid *cd, size_t capacity);
+
+	// ranks must be ascending.
+	// out[i] is the first centroid whose cumulative weight reaches ranks[i], or size.
+	// whole blocks are skipped while their weight sum stays below the rank.
+	void rankCrossing(const Centroid *cd, size_t size, const double *ranks, size_t count, size_t *out);
+
+	// sum of mean * weight and sum of weight.
+	// summed in lanes, fused on AVX-512 - last bits differ between kernels.
+	std::pair<double, uint64_t> weightedSum(const Centroid *cd, size_t size);
+
+	// end of the merge group, that starts at start - first i where
+	// (group weight up to i, or 1) * (mean[i] - mean[start]) is not <= delta, or size.
+	// the product only grows, so whole blocks are tested at once.
+	size_t groupEnd(const Centroid *cd, size_t start, size_t size, double delta, bool useWeight);
+
+	const char *name();
+}
+
+#endif
+
@@ -0,0 +1,172 @@
+#include "tdigest_maintenance.h"
+
+#include <atomic>
+#include <unordered_set>
+#include <algorithm>
+
+void MaintenanceScheduler::start(TDigestStore &store, Job job){
+	job_ = job;
+	next_ = 0;
+
+	keys_.clear();
+
+	if (job_ == Job::COMPRESS){
+		// the rest is compressed since
+		store.forEachChanged(compressed_, [this](std::string const &key, TDigestStore::Digest const *digest){
+			if (digest)
+				keys_.push_back(key);
+		});
+
+		compressed_ = store.advance() + 1;
+	}else{
+		keys_.reserve(store.size());
+
+		store.forEach([this](std::string const &key, auto const &){
+			keys_.push_back(key);
+		});
+	}
+
+	dests_.clear();
+
+	if (job_ == Job::MERGE){
+		dests_.resize(keys_.size());
+
+		std::unordered_set<std::string> targets;
+
+		for(size_t i = 0; i < keys_.size(); ++i){
+			if (config_.rollup)
+				dests_[i] = config_.rollup(keys_[i]);
+
+			if (dests_[i] == keys_[i])
+				dests_[i].clear();
+
+			if (!dests_[i].empty())
+				targets.insert(dests_[i]);
+		}
+
+		// destinations wait for the next job, one level at a time
+		for(size_t i = 0; i < keys_.size(); ++i)
+			if (targets.count(keys_[i]))
+				dests_[i].clear();
+	}
+
+	blobs_.clear();
+
+	if (job_ == Job::SERIALIZE)
+		blobs_.resize(keys_.size());
+
+	stats_ = {};
+	stats_.keys = keys_.size();
+}
+
+bool MaintenanceScheduler::step(TDigestStore &store){
+	if (finished())
+		return false;
+
+	auto const chunk  = std::max<size_t>(config_.chunk, 1);
+	auto const round  = config_.round ? config_.round : 4 * pool_.threads();
+
+	auto const first  = next_;
+	auto const last   = std::min(keys_.size(), first + chunk * round);
+	auto const chunks = (last - first + chunk - 1) / chunk;
+
+	std::atomic<size_t> changed{ 0 };
+
+	partials_.resize(chunks);
+
+	pool_.parallelFor(chunks, [&](size_t i){
+		auto const a = first + i * chunk;
+		auto const b = std::min(a + chunk, last);
+
+		changed.fetch_add(process_(store, a, b, partials_[i]), std::memory_order_relaxed);
+	});
+
+	// MERGE - in chunk order, then the sources are gone
+	for(size_t i = 0; i < chunks; ++i){
+		for(auto const &[dest, digest] : partials_[i])
+			store.get(dest).merge(digest);
+
+		partials_[i].clear();
+	}
+
+	if (job_ == Job::MERGE)
+		for(size_t i = first; i < last; ++i)
+			if (!dests_[i].empty())
+				store.erase(keys_[i]);
+
+	next_ = last;
+
+	++stats_.steps;
+	stats_.done	= next_;
+	stats_.changed	+= changed.load();
+
+	return !finished();
+}
+
+size_t MaintenanceScheduler::process_(TDigestStore &store, size_t first, size_t last, Partial &partial){
+	size_t changed = 0;
+
+	for(size_t i = first; i < last; ++i){
+		auto const &key = keys_[i];
+
+		if (job_ == Job::SERIALIZE){
+			auto const *digest = store.find(key);
+
+			// each task writes own blobs only
+			if (digest){
+				blobs_[i].key = key;
+				blobs_[i].data.resize(digest->bytes());
+				digest->store(blobs_[i].data.data());
+			}
+
+			continue;
+		}
+
+		if (job_ == Job::MERGE){
+			auto const *digest = store.find(key);
+			auto const &dest = dests_[i];
+
+			if (!digest || dest.empty())
+				continue;
+
+			if (auto [it, inserted] = partial.try_emplace(dest, *digest); !inserted)
+				it->second.merge(*digest);
+
+			++changed;
+			continue;
+		}
+
+		// erased since start(), slot is stamped only if changed
+		switch(job_){
+		case Job::COMPRESS:
+			changed += store.update(key, [](TDigestStore::Digest &digest){
+				auto const size = digest.size();
+
+				return digest.compress() != size;
+			});
+
+			break;
+
+		case Job::RECOMPRESS:
+			if (store.idle(key) < config_.coldTicks)
+				break;
+
+			changed += store.update(key, [this](TDigestStore::Digest &digest){
+				if (digest.capacity() <= config_.coldCapacity)
+					return false;
+
+				digest.recompressTo(config_.coldCapacity);
+
+				return true;
+			});
+
+			break;
+
+		case Job::MERGE:
+		case Job::SERIALIZE:
+			break;
+		}
+	}
+
+	return changed;
+}
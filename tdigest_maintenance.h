@@ -0,0 +1,135 @@
+#ifndef T_DIGEST_MAINTENANCE_H_
+#define T_DIGEST_MAINTENANCE_H_
+
+#include "tdigest_store.h"
+#include "thread_pool.h"
+
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Store wide maintenance on work stealing pool.
+//
+// job takes the keys at start() and splits them into chunks.
+// each step() runs one round of chunks in parallel -
+// caller must keep the store away from other threads during the step,
+// e.g. inside TDigestIngest::read(). between the rounds foreground gets
+// the store back, and while busy() says it is loaded, run() backs off.
+//
+// COMPRESS takes only the keys changed since the previous COMPRESS.
+// MERGE rolls keys up - each key is merged into rollup(key) and erased,
+// so running it again merges only what came since. tasks merge into own
+// partial digests, the step merges them into the store in chunk order,
+// so the result does not depend on the threads. one level per job -
+// key that is destination of another key is not rolled up in the same
+// job, the next job takes it with what it received.
+//
+// RECOMPRESS allocates from the store allocator in parallel,
+// so the allocator must be thread safe.
+
+struct MaintenanceConfig{
+	size_t				chunk		= 64;	// keys per task
+	size_t				round		= 0;	// chunks per step, 0 - 4 per thread
+
+	size_t				coldCapacity	= 8;	// RECOMPRESS target
+	unsigned			coldTicks	= 2;	// RECOMPRESS keys idle that many ticks
+
+	// MERGE destination of the key, empty or the key itself - skipped.
+	// called in start()
+	std::function<std::string(std::string const &)>	rollup;
+
+	std::function<bool()>		busy;
+	std::chrono::microseconds	backoff		{ 500 };
+};
+
+class MaintenanceScheduler{
+public:
+	enum class Job{
+		COMPRESS	,
+		RECOMPRESS	,
+		MERGE		,
+		SERIALIZE
+	};
+
+	struct Blob{
+		std::string		key;
+		std::vector<char>	data;
+	};
+
+	struct Stats{
+		size_t		keys		= 0;
+		size_t		done		= 0;	// keys processed so far
+		size_t		steps		= 0;
+		size_t		backoffs	= 0;
+		size_t		changed		= 0;	// compressed, recompressed or merged digests
+	};
+
+public:
+	MaintenanceScheduler(WorkStealingPool &pool, MaintenanceConfig const &config = {}) :
+					pool_(pool),
+					config_(config){}
+
+	// COMPRESS advances the store version,
+	// MERGE erases the merged keys in step()
+	void start(TDigestStore &store, Job job);
+
+	// one round, false if the job is finished
+	bool step(TDigestStore &store);
+
+	bool finished() const{
+		return next_ >= keys_.size();
+	}
+
+	// withStore(f) - gives the store to f, e.g. TDigestIngest::read().
+	// whole job, backs off between the steps while busy()
+	template<typename F>
+	void run(Job job, F withStore){
+		withStore([this, job](TDigestStore &store){
+			start(store, job);
+			return true;
+		});
+
+		while(withStore([this](TDigestStore &store){ return step(store); })){
+			while(config_.busy && config_.busy()){
+				++stats_.backoffs;
+				std::this_thread::sleep_for(config_.backoff);
+			}
+		}
+	}
+
+	// SERIALIZE result, key order
+	std::vector<Blob> const &blobs() const{
+		return blobs_;
+	}
+
+	Stats const &stats() const{
+		return stats_;
+	}
+
+private:
+	using Partial = std::unordered_map<std::string, TDigestStore::Digest>;
+
+	size_t process_(TDigestStore &store, size_t first, size_t last, Partial &partial);
+
+private:
+	WorkStealingPool		&pool_;
+	MaintenanceConfig		config_;
+
+	Job				job_	= Job::COMPRESS;
+	std::vector<std::string>	keys_;
+	std::vector<std::string>	dests_;		// MERGE, per key, empty - skipped
+	size_t				next_	= 0;
+
+	std::vector<Blob>		blobs_;
+	std::vector<Partial>		partials_;	// MERGE, per chunk of the step
+
+	uint64_t			compressed_	= 0;	// store version after the last COMPRESS start
+
+	Stats				stats_;
+};
+
+#endif
+
@@ -0,0 +1,233 @@
+#ifndef T_DIGEST_OWNER_H_
+#define T_DIGEST_OWNER_H_
+
+#include "tdigest.h"
+
+#include <array>
+#include <algorithm>	// max
+#include <cstddef>	// std::byte
+#include <utility>	// exchange
+#include <memory_resource>
+
+// Owning digest - RawTDigest together with its centroid blob.
+// capacity up to InlineCapacity is stored inside the object,
+// larger capacity is allocated from the memory resource.
+//
+// moved from digest can only be destroyed or assigned to.
+
+template<size_t InlineCapacity = 16>
+class TDigest{
+public:
+	using Centroid		= RawTDigest::Centroid;
+	using Compression	= RawTDigest::Compression;
+	using allocator_type	= std::pmr::polymorphic_allocator<std::byte>;
+
+	constexpr static size_t INLINE_CAPACITY = InlineCapacity;
+
+public:
+	TDigest(size_t capacity, double delta, double epsilon = 0.0, allocator_type const &allocator = {}) :
+					td_(capacity, delta, epsilon),
+					allocator_(allocator){
+		allocate_();
+		td_.clearFast(data_);
+	}
+
+	TDigest(RawTDigest const &td, const Centroid *cd, allocator_type const &allocator = {}) :
+					td_(td),
+					allocator_(allocator){
+		allocate_();
+		td_.load(data_, cd);
+	}
+
+	TDigest(TDigest const &other, allocator_type const &allocator = {}) :
+					TDigest(other.td_, other.data_, allocator){}
+
+	TDigest(TDigest &&other) noexcept :
+					td_(other.td_),
+					allocator_(other.allocator_){
+		steal_(other);
+	}
+
+	TDigest &operator=(TDigest const &other){
+		if (this != &other){
+			TDigest copy{ other, allocator_ };
+			*this = std::move(copy);
+		}
+
+		return *this;
+	}
+
+	// not noexcept - allocator stays, it is not propagated,
+	// so blob from other resource is copied and that may throw.
+	// this is not changed then.
+	TDigest &operator=(TDigest &&other){
+		if (this == &other)
+			return *this;
+
+		if (other.data_ && !other.isInline() && other.allocator_ != allocator_){
+			TDigest copy{ other, allocator_ };
+			return *this = std::move(copy);
+		}
+
+		deallocate_();
+
+		td_ = other.td_;
+		steal_(other);
+
+		return *this;
+	}
+
+	~TDigest(){
+		deallocate_();
+	}
+
+public:
+	RawTDigest const &raw() const{
+		return td_;
+	}
+
+	Centroid *data(){
+		return data_;
+	}
+
+	const Centroid *data() const{
+		return data_;
+	}
+
+	size_t capacity() const{
+		return td_.capacity();
+	}
+
+	size_t bytes() const{
+		return td_.bytes();
+	}
+
+	bool isInline() const{
+		return isInline_(td_.capacity());
+	}
+
+	allocator_type get_allocator() const{
+		return allocator_;
+	}
+
+	void print() const{
+		td_.print(data_);
+	}
+
+public:
+	void clear(){
+		td_.clear(data_);
+	}
+
+	void load(const void *src){
+		td_.load(data_, src);
+	}
+
+	void store(void *dest) const{
+		td_.store(data_, dest);
+	}
+
+public:
+	template<Compression C = Compression::AGGRESSIVE>
+	void add(double value, uint64_t weight = 1){
+		td_.template add<C>(data_, value, weight);
+	}
+
+	void add(double *values, size_t count){
+		td_.add(data_, values, count);
+	}
+
+	template<size_t N>
+	void merge(TDigest<N> const &other){
+		td_.merge(data_, other.raw(), other.data());
+	}
+
+	size_t compress(){
+		return td_.compress(data_);
+	}
+
+	// optimal recompression, then shrink to the new size
+	void recompressTo(size_t capacity){
+		td_.recompressTo(data_, capacity);
+		resize(std::max<size_t>(capacity, 2));
+	}
+
+	// grow copies into larger blob, shrink compresses into smaller one.
+	void resize(size_t capacity){
+		if (capacity == td_.capacity())
+			return;
+
+		TDigest other{ capacity, td_.delta(), td_.epsilon(), allocator_ };
+		other.td_.merge(other.data_, td_, data_);
+
+		*this = std::move(other);
+	}
+
+	size_t size() const{
+		return td_.size(data_);
+	}
+
+	uint64_t weight() const{
+		return td_.weight(data_);
+	}
+
+	double percentile_50() const{
+		return td_.percentile_50(data_);
+	}
+
+	double percentile_95() const{
+		return td_.percentile_95(data_);
+	}
+
+	double percentile(double const p) const{
+		return td_.percentile(data_, p);
+	}
+
+	template<typename IT, typename OutIT>
+	void percentile(IT first, IT last, OutIT out) const{
+		return td_.percentile(data_, first, last, out);
+	}
+
+private:
+	constexpr static bool isInline_(size_t capacity){
+		return capacity <= InlineCapacity;
+	}
+
+	void allocate_(){
+		if (isInline())
+			data_ = reinterpret_cast<Centroid *>(inline_.data());
+		else
+			data_ = static_cast<Centroid *>(allocator_.resource()->allocate(td_.bytes(), alignof(std::max_align_t)));
+	}
+
+	void deallocate_(){
+		if (data_ && !isInline())
+			allocator_.resource()->deallocate(data_, td_.bytes(), alignof(std::max_align_t));
+
+		data_ = nullptr;
+	}
+
+	// td_ is already copied
+	void steal_(TDigest &other){
+		if (!other.data_){
+			data_ = nullptr;
+		}else if (other.isInline()){
+			data_ = reinterpret_cast<Centroid *>(inline_.data());
+			td_.load(data_, other.data_);
+			other.data_ = nullptr;
+		}else{
+			data_ = std::exchange(other.data_, nullptr);
+		}
+	}
+
+private:
+	RawTDigest		td_;
+	allocator_type		allocator_;
+	Centroid		*data_		= nullptr;
+
+	alignas(std::max_align_t)
+	std::array<std::byte, RawTDigest::bytes(InlineCapacity)>	inline_;
+};
+
+#endif
+
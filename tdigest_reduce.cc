@@ -0,0 +1,93 @@
+#include "tdigest_reduce.h"
+#include "tdigest_centroid.h"
+
+#include <memory>
+#include <vector>
+#include <algorithm>	// min
+
+void mergeTree(WorkStealingPool &pool,
+		RawTDigest const &td, RawTDigest::Centroid *dest,
+		RawTDigest const &srcTD, const RawTDigest::Centroid *const *srcs, size_t count,
+		size_t fanout){
+
+	using Centroid = RawTDigest::Centroid;
+
+	assert(fanout >= 2);
+
+	auto const capacity = td.capacity();
+
+	std::vector<const Centroid *> level{ srcs, srcs + count };
+
+	std::unique_ptr<Centroid[]> buffer;
+
+	const RawTDigest *levelTD = &srcTD;
+
+	while(level.size() > fanout){
+		auto const size   = level.size();
+		auto const groups = (size + fanout - 1) / fanout;
+
+		auto next = std::make_unique<Centroid[]>(groups * capacity);
+
+		pool.parallelFor(groups, [&](size_t g){
+			auto *out = next.get() + g * capacity;
+
+			auto const first = g * fanout;
+
+			td.clearFast(out);
+			td.merge(out, *levelTD, level.data() + first, std::min(fanout, size - first));
+		});
+
+		level.resize(groups);
+
+		for(size_t g = 0; g < groups; ++g)
+			level[g] = next.get() + g * capacity;
+
+		buffer  = std::move(next);
+		levelTD = &td;
+	}
+
+	// root
+	td.clearFast(dest);
+	td.merge(dest, *levelTD, level.data(), level.size());
+}
+
+void buildParallel(WorkStealingPool &pool,
+		RawTDigest const &td, RawTDigest::Centroid *dest,
+		double *values, size_t count,
+		size_t partition){
+
+	using Centroid = RawTDigest::Centroid;
+
+	assert(partition);
+
+	auto const capacity   = td.capacity();
+	auto const partitions = (count + partition - 1) / partition;
+
+	auto parts = std::make_unique<Centroid[]>(partitions * capacity);
+
+	pool.parallelFor(partitions, [&](size_t i){
+		auto *out = parts.get() + i * capacity;
+
+		auto const first = i * partition;
+
+		td.clearFast(out);
+		td.add(out, values + first, std::min(partition, count - first));
+	});
+
+	std::vector<const Centroid *> srcs(partitions);
+
+	for(size_t i = 0; i < partitions; ++i)
+		srcs[i] = parts.get() + i * capacity;
+
+	mergeTree(pool, td, dest, td, srcs.data(), srcs.size());
+}
+
+void buildParallel(RawTDigest const &td, RawTDigest::Centroid *dest,
+		double *values, size_t count,
+		size_t threads){
+
+	WorkStealingPool pool{ threads };
+
+	buildParallel(pool, td, dest, values, count);
+}
+
@@ -0,0 +1,40 @@
+#ifndef T_DIGEST_REDUCE_H_
+#define T_DIGEST_REDUCE_H_
+
+#include "tdigest.h"
+#include "thread_pool.h"
+
+// Parallel tree merge of many digests into one.
+//
+// each level merges groups of fanout consecutive blobs at once,
+// groups of the level run in parallel.
+// tree shape depends on count and fanout only, never on the threads,
+// so the result is the same bytes for any pool size.
+//
+// dest is overwritten, intermediate blobs have capacity of td.
+
+void mergeTree(WorkStealingPool &pool,
+		RawTDigest const &td, RawTDigest::Centroid *dest,
+		RawTDigest const &srcTD, const RawTDigest::Centroid *const *srcs, size_t count,
+		size_t fanout = 8);
+
+// Parallel build from raw values.
+//
+// input is split into fixed partitions, each one is batch added into
+// its own blob in parallel, then the blobs are tree merged.
+// partitions do not depend on the threads, so neither does the result.
+//
+// values are sorted in place per partition, NaN are skipped.
+// dest is overwritten.
+
+void buildParallel(WorkStealingPool &pool,
+		RawTDigest const &td, RawTDigest::Centroid *dest,
+		double *values, size_t count,
+		size_t partition = 1 << 18);
+
+void buildParallel(RawTDigest const &td, RawTDigest::Centroid *dest,
+		double *values, size_t count,
+		size_t threads);
+
+#endif
+
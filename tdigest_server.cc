@@ -0,0 +1,571 @@
+#include "tdigest_store.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <charconv>
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// tdigest_server - keyed digests over line protocol.
+//
+//	ADD key value [weight]		-> OK
+//	ADDMANY key value...		-> OK count
+//	QUANTILE key p...		-> value...
+//	MERGE dst src...		-> OK
+//	PING				-> PONG
+//	errors				-> ERR message
+//
+// single threaded epoll loop over TDigestStore.
+// client may pipeline - every complete line of a read is processed
+// and the replies go out in single write.
+
+namespace{
+	constexpr size_t READ_SIZE	= 64 * 1024;
+	constexpr size_t INPUT_LIMIT	= 4 << 20;	// process before reading more, longest line
+	constexpr size_t OUTPUT_LIMIT	= 16 << 20;	// stop reading the client above it
+	constexpr int    MAX_EVENTS	= 256;
+
+	volatile sig_atomic_t stop = 0;
+
+	std::string_view nextToken(std::string_view &line){
+		while(!line.empty() && (line.front() == ' ' || line.front() == '\t'))
+			line.remove_prefix(1);
+
+		auto const end = std::min(line.find_first_of(" \t"), line.size());
+
+		auto const token = line.substr(0, end);
+		line.remove_prefix(end);
+
+		return token;
+	}
+
+	template<typename T>
+	bool parse(std::string_view s, T &value){
+		auto const [p, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+
+		return ec == std::errc{} && p == s.data() + s.size() && !s.empty();
+	}
+
+	// no nan or inf, they break the digest ordering
+	bool parseValue(std::string_view s, double &value){
+		return parse(s, value) && std::isfinite(value);
+	}
+
+	void appendDouble(std::string &out, double x){
+		char buffer[32];
+
+		auto const [p, ec] = std::to_chars(buffer, buffer + sizeof buffer, x);
+
+		out.append(buffer, p);
+	}
+
+
+
+	class Server{
+	public:
+		explicit Server(double delta) : store_(delta){}
+
+		~Server();
+
+		bool listenUnix(const char *path);
+
+		bool listenTCP(const char *address, uint16_t port);
+
+		bool run();
+
+	private:
+		struct Connection{
+			std::string	in;
+			std::string	out;
+			size_t		outPos	= 0;
+			size_t		scanned	= 0;	// in has no newline before it
+			uint32_t	events	= EPOLLIN;
+			bool		closed	= false;
+		};
+
+		bool start_(int fd);
+
+		void accept_();
+
+		void read_(int fd, Connection &c);
+
+		void process_(Connection &c);
+
+		void command_(std::string_view line, std::string &out);
+
+		void flush_(int fd, Connection &c);
+
+		void close_(int fd);
+
+	private:
+		TDigestStore				store_;
+
+		int					epoll_	= -1;
+		int					listen_	= -1;
+
+		std::unordered_map<int, Connection>	connections_;
+
+		std::vector<double>			values_;
+		std::vector<double>			out_;
+	};
+
+	Server::~Server(){
+		for(auto const &[fd, _] : connections_)
+			close(fd);
+
+		if (listen_ >= 0)
+			close(listen_);
+
+		if (epoll_ >= 0)
+			close(epoll_);
+	}
+
+	bool Server::start_(int fd){
+		if (::listen(fd, SOMAXCONN) < 0){
+			close(fd);
+			return false;
+		}
+
+		epoll_ = epoll_create1(EPOLL_CLOEXEC);
+
+		if (epoll_ < 0){
+			close(fd);
+			return false;
+		}
+
+		listen_ = fd;
+
+		epoll_event ev{};
+		ev.events	= EPOLLIN;
+		ev.data.fd	= fd;
+
+		return epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &ev) == 0;
+	}
+
+	bool Server::listenUnix(const char *path){
+		sockaddr_un addr{};
+		addr.sun_family = AF_UNIX;
+
+		if (strlen(path) >= sizeof addr.sun_path)
+			return false;
+
+		strcpy(addr.sun_path, path);
+
+		int const fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+		if (fd < 0)
+			return false;
+
+		unlink(path);
+
+		if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) < 0){
+			close(fd);
+			return false;
+		}
+
+		return start_(fd);
+	}
+
+	bool Server::listenTCP(const char *address, uint16_t port){
+		sockaddr_in addr{};
+		addr.sin_family	= AF_INET;
+		addr.sin_port	= htons(port);
+
+		if (inet_pton(AF_INET, address, &addr.sin_addr) != 1)
+			return false;
+
+		int const fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+		if (fd < 0)
+			return false;
+
+		int const one = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+
+		if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) < 0){
+			close(fd);
+			return false;
+		}
+
+		return start_(fd);
+	}
+
+	bool Server::run(){
+		epoll_event events[MAX_EVENTS];
+
+		while(!stop){
+			int const n = epoll_wait(epoll_, events, MAX_EVENTS, -1);
+
+			if (n < 0){
+				if (errno == EINTR)
+					continue;
+
+				return false;
+			}
+
+			for(int i = 0; i < n; ++i){
+				int const fd = events[i].data.fd;
+
+				if (fd == listen_){
+					accept_();
+					continue;
+				}
+
+				auto it = connections_.find(fd);
+
+				if (it == connections_.end())
+					continue;
+
+				auto &c = it->second;
+
+				if (events[i].events & (EPOLLERR | EPOLLHUP))
+					c.closed = true;
+
+				if (!c.closed && (events[i].events & EPOLLOUT))
+					flush_(fd, c);
+
+				if (!c.closed && (events[i].events & EPOLLIN))
+					read_(fd, c);
+
+				if (c.closed)
+					close_(fd);
+			}
+		}
+
+		return true;
+	}
+
+	void Server::accept_(){
+		for(;;){
+			int const fd = accept4(listen_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+			if (fd < 0)
+				return;
+
+			int const one = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+			epoll_event ev{};
+			ev.events	= EPOLLIN;
+			ev.data.fd	= fd;
+
+			if (epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &ev) < 0){
+				close(fd);
+				continue;
+			}
+
+			connections_.emplace(fd, Connection{});
+		}
+	}
+
+	void Server::read_(int fd, Connection &c){
+		for(;;){
+			auto const size = c.in.size();
+
+			c.in.resize(size + READ_SIZE);
+
+			auto const n = read(fd, c.in.data() + size, READ_SIZE);
+
+			c.in.resize(size + static_cast<size_t>(std::max<ssize_t>(n, 0)));
+
+			if (n > 0){
+				// level triggered, the rest comes on the next wait
+				if (c.in.size() >= INPUT_LIMIT)
+					break;
+
+				continue;
+			}
+
+			if (n < 0 && errno == EINTR)
+				continue;
+
+			if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+				c.closed = true;
+
+			break;
+		}
+
+		process_(c);
+		flush_(fd, c);
+	}
+
+	void Server::process_(Connection &c){
+		std::string_view in = c.in;
+
+		size_t done = 0;
+
+		while(c.out.size() - c.outPos <= OUTPUT_LIMIT){
+			auto const eol = in.find('\n', std::max(done, c.scanned));
+
+			if (eol == std::string_view::npos){
+				c.scanned = in.size();
+				break;
+			}
+
+			auto line = in.substr(done, eol - done);
+
+			if (!line.empty() && line.back() == '\r')
+				line.remove_suffix(1);
+
+			command_(line, c.out);
+
+			done = eol + 1;
+		}
+
+		c.in.erase(0, done);
+		c.scanned = std::max(c.scanned, done) - done;
+
+		if (c.in.size() >= INPUT_LIMIT && c.scanned == c.in.size()){
+			// no newline, it would grow forever
+			c.out += "ERR line too long\n";
+			c.in.clear();
+			c.closed = true;
+		}
+	}
+
+	void Server::command_(std::string_view line, std::string &out){
+		auto const cmd = nextToken(line);
+
+		if (cmd.empty())
+			return;
+
+		auto error = [&out](const char *message){
+			out += "ERR ";
+			out += message;
+			out += '\n';
+		};
+
+		if (cmd == "PING"){
+			out += "PONG\n";
+			return;
+		}
+
+		auto const key = nextToken(line);
+
+		if (key.empty())
+			return error("missing key");
+
+		if (cmd == "ADD"){
+			double value;
+			uint64_t weight = 1;
+
+			if (!parseValue(nextToken(line), value))
+				return error("bad value");
+
+			if (auto const w = nextToken(line); !w.empty() && (!parse(w, weight) || weight == 0))
+				return error("bad weight");
+
+			if (!nextToken(line).empty())
+				return error("too many arguments");
+
+			store_.add(key, value, weight);
+
+			out += "OK\n";
+			return;
+		}
+
+		if (cmd == "ADDMANY"){
+			values_.clear();
+
+			for(auto t = nextToken(line); !t.empty(); t = nextToken(line)){
+				double value;
+
+				if (!parseValue(t, value))
+					return error("bad value");
+
+				values_.push_back(value);
+			}
+
+			store_.add(key, values_.data(), values_.size());
+
+			out += "OK ";
+			out += std::to_string(values_.size());
+			out += '\n';
+			return;
+		}
+
+		if (cmd == "QUANTILE"){
+			values_.clear();
+
+			for(auto t = nextToken(line); !t.empty(); t = nextToken(line)){
+				double p;
+
+				if (!parseValue(t, p) || p < 0 || p > 1)
+					return error("bad quantile");
+
+				values_.push_back(p);
+			}
+
+			auto const *digest = store_.find(key);
+
+			if (!digest)
+				return error("no such key");
+
+			out_.resize(values_.size());
+			digest->percentile(std::begin(values_), std::end(values_), std::begin(out_));
+
+			for(size_t i = 0; i < out_.size(); ++i){
+				if (i)
+					out += ' ';
+
+				appendDouble(out, out_[i]);
+			}
+
+			out += '\n';
+			return;
+		}
+
+		if (cmd == "MERGE"){
+			// check all first, command is all or nothing
+			std::vector<std::string_view> srcs;
+
+			for(auto t = nextToken(line); !t.empty(); t = nextToken(line)){
+				if (!store_.find(t))
+					return error("no such key");
+
+				if (t != key)
+					srcs.push_back(t);
+			}
+
+			auto &dest = store_.get(key);
+
+			for(auto const &src : srcs)
+				dest.merge(*store_.find(src));
+
+			out += "OK\n";
+			return;
+		}
+
+		error("unknown command");
+	}
+
+	void Server::flush_(int fd, Connection &c){
+		while(c.outPos < c.out.size()){
+			auto const n = write(fd, c.out.data() + c.outPos, c.out.size() - c.outPos);
+
+			if (n < 0){
+				if (errno != EAGAIN && errno != EWOULDBLOCK)
+					c.closed = true;
+
+				break;
+			}
+
+			c.outPos += static_cast<size_t>(n);
+		}
+
+		if (c.outPos == c.out.size()){
+			c.out.clear();
+			c.outPos = 0;
+
+			// input held back by the output limit
+			if (!c.in.empty() && c.in.find('\n', c.scanned) != std::string::npos){
+				process_(c);
+
+				if (!c.out.empty())
+					return flush_(fd, c);
+			}
+		}
+
+		// stop reading the client, that does not read its replies
+		auto const pending = c.out.size() - c.outPos;
+
+		uint32_t const events = (pending <= OUTPUT_LIMIT ? EPOLLIN : 0) | (pending ? EPOLLOUT : 0);
+
+		if (events != c.events && !c.closed){
+			epoll_event ev{};
+			ev.events	= events;
+			ev.data.fd	= fd;
+
+			epoll_ctl(epoll_, EPOLL_CTL_MOD, fd, &ev);
+
+			c.events = events;
+		}
+	}
+
+	void Server::close_(int fd){
+		epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr);
+		close(fd);
+
+		connections_.erase(fd);
+	}
+
+	int usage(const char *name){
+		fprintf(stderr,
+			"Usage: %s [-u path | -p port [-b address]] [-D delta]\n"
+			"\n"
+			"\t-u path\t\tlisten on unix socket\n"
+			"\t-p port\t\tlisten on tcp port\n"
+			"\t-b address\ttcp address, default 127.0.0.1\n"
+			"\t-D delta\tcompression delta, default 0.01\n",
+			name);
+
+		return 1;
+	}
+}
+
+int main(int argc, char **argv){
+	const char	*path		= nullptr;
+	const char	*address	= "127.0.0.1";
+	long		port		= 0;
+	double		delta		= 0.01;
+
+	for(int c; (c = getopt(argc, argv, "u:p:b:D:h")) != -1;){
+		switch(c){
+		case 'u': path		= optarg;			break;
+		case 'p': port		= strtol(optarg, nullptr, 10);	break;
+		case 'b': address	= optarg;			break;
+		case 'D': delta		= strtod(optarg, nullptr);	break;
+		default : return usage(argv[0]);
+		}
+	}
+
+	if (!path && (port <= 0 || port > 65535))
+		return usage(argv[0]);
+
+	signal(SIGPIPE, SIG_IGN);
+
+	struct sigaction sa{};
+	sa.sa_handler = [](int){
+		stop = 1;
+	};
+
+	sigaction(SIGINT,  &sa, nullptr);
+	sigaction(SIGTERM, &sa, nullptr);
+
+	Server server{ delta };
+
+	bool const ok = path ?
+			server.listenUnix(path) :
+			server.listenTCP(address, static_cast<uint16_t>(port));
+
+	if (!ok){
+		perror("listen");
+		return 1;
+	}
+
+	if (!server.run()){
+		perror("epoll");
+		return 1;
+	}
+
+	if (path)
+		unlink(path);
+}
+
@@ -0,0 +1,144 @@
+#include "tdigest_sharded.h"
+
+ShardedTDigestStore::ShardedTDigestStore(double delta, size_t shards, size_t producers, ShardedConfig const &config) :
+				producers_(producers),
+				config_(config){
+	assert(shards && producers);
+
+	shards_.reserve(shards);
+
+	auto const nodes = config_.numa ? numa::nodes() : 1;
+
+	for(size_t i = 0; i < shards; ++i){
+		auto const node = static_cast<int>(i % nodes);
+
+		auto shard = std::make_unique<Shard>(delta, config_.sizing, node, config_.numa);
+
+		shard->queues.reserve(producers);
+
+		for(size_t j = 0; j < producers; ++j)
+			shard->queues.push_back(std::make_unique<SPSCRing<Sample> >(config_.queueCapacity));
+
+		shard->batch.reserve(config_.batch);
+
+		shards_.push_back(std::move(shard));
+	}
+
+	// threads start, once all shards are there
+	for(auto &shard : shards_)
+		shard->thread = std::thread{ &ShardedTDigestStore::owner_, this, std::ref(*shard) };
+}
+
+ShardedTDigestStore::~ShardedTDigestStore(){
+	stop_.store(true);
+
+	for(auto &shard : shards_)
+		shard->thread.join();
+}
+
+void ShardedTDigestStore::Producer::add(std::string_view key, double value, uint64_t weight){
+	auto &queue = *owner_->shards_[owner_->shardOf(key)]->queues[id_];
+
+	Sample sample{ std::string{ key }, value, weight };
+
+	if (queue.tryPush(std::move(sample)))
+		return;
+
+	++stalls_;
+
+	// failed push does not touch the sample
+	while(!queue.tryPush(std::move(sample)))
+		std::this_thread::yield();
+}
+
+void ShardedTDigestStore::flush(){
+	for(auto &shard : shards_)
+		for(auto &queue : shard->queues)
+			while(!queue->empty())
+				std::this_thread::yield();
+
+	// popped is not applied yet, mailbox runs after the batch
+	gather([](TDigestStore const &){
+		return 0;
+	});
+}
+
+TDigestStore::Stats ShardedTDigestStore::stats(){
+	TDigestStore::Stats stats;
+
+	for(auto const &s : gather([](TDigestStore const &store){ return store.stats(); })){
+		stats.keys	+= s.keys;
+		stats.bytes	+= s.bytes;
+		stats.grown	+= s.grown;
+		stats.shrunk	+= s.shrunk;
+	}
+
+	return stats;
+}
+
+auto ShardedTDigestStore::placement() -> std::vector<NodeArena::Placement>{
+	if (!config_.numa)
+		return {};
+
+	// arena is owned by the shard thread
+	return onShards_([](Shard &shard){
+		return shard.nodeArena.placement();
+	});
+}
+
+void ShardedTDigestStore::post_(Shard &shard, std::function<void()> f){
+	std::lock_guard lock{ shard.mutex };
+
+	shard.mailbox.push_back(std::move(f));
+	shard.posted.store(true, std::memory_order_release);
+}
+
+void ShardedTDigestStore::owner_(Shard &shard){
+	// before the first allocation
+	if (config_.numa)
+		numa::pinThread(shard.node);
+
+	std::vector<std::function<void()> > mailbox;
+
+	for(;;){
+		// stop is checked before the drain, so last push is never missed
+		bool const stop = stop_.load();
+
+		auto &batch = shard.batch;
+
+		batch.clear();
+
+		Sample sample;
+
+		for(auto &queue : shard.queues)
+			for(size_t i = 0; i < config_.batch && queue->tryPop(sample); ++i)
+				batch.push_back(std::move(sample));
+
+		if (!batch.empty())
+			shard.store.add(batch.data(), batch.size());
+
+		if (shard.posted.load(std::memory_order_acquire)){
+			{
+				std::lock_guard lock{ shard.mutex };
+
+				mailbox.swap(shard.mailbox);
+				shard.posted.store(false, std::memory_order_relaxed);
+			}
+
+			for(auto &f : mailbox)
+				f();
+
+			mailbox.clear();
+
+			continue;
+		}
+
+		if (batch.empty()){
+			if (stop)
+				return;
+
+			std::this_thread::sleep_for(config_.idleSleep);
+		}
+	}
+}
+
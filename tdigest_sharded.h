@@ -0,0 +1,205 @@
+#ifndef T_DIGEST_SHARDED_H_
+#define T_DIGEST_SHARDED_H_
+
+#include "tdigest_store.h"
+#include "spsc_ring.h"
+#include "numa_arena.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Share-nothing sharded store.
+//
+// each shard owns its keys, its own store and arena, and one owner thread.
+// producer P sends samples for shard S through its own SPSC queue [P][S],
+// so ingest path has no lock and no cache line written by two threads.
+//
+// with numa, shard i lives on node i % nodes - arena is node local
+// and the owner thread is pinned to the cpus of the node.
+//
+// queries are posted to the owning shard and run on its thread,
+// gather() runs on every shard and collects the results.
+
+struct ShardedConfig{
+	size_t				queueCapacity	= 4096;		// per producer and shard, power of 2
+	size_t				batch		= 1024;
+	AdaptiveSizing			sizing		= {};
+	std::chrono::microseconds	idleSleep	{ 50 };
+	bool				numa		= false;
+};
+
+class ShardedTDigestStore{
+public:
+	using Digest	= TDigestStore::Digest;
+	using Sample	= TDigestStore::Sample;
+
+	class Producer;
+
+public:
+	ShardedTDigestStore(double delta, size_t shards, size_t producers, ShardedConfig const &config = {});
+
+	ShardedTDigestStore(ShardedTDigestStore const &) = delete;
+	ShardedTDigestStore &operator=(ShardedTDigestStore const &) = delete;
+
+	// applies everything pushed so far
+	~ShardedTDigestStore();
+
+	size_t shards() const{
+		return shards_.size();
+	}
+
+	size_t producers() const{
+		return producers_;
+	}
+
+	size_t shardOf(std::string_view key) const{
+		return std::hash<std::string_view>{}(key) % shards_.size();
+	}
+
+	// handle for single producer thread, id < producers()
+	Producer producer(size_t id);
+
+	// waits until everything pushed so far is applied
+	void flush();
+
+	// f(const Digest *) on the owning shard, nullptr if the key is not there
+	template<typename F>
+	auto query(std::string_view key, F f){
+		return run_(shardOf(key), [&](TDigestStore const &store){
+			return f(store.find(key));
+		});
+	}
+
+	// f(TDigestStore const &) on every shard, in parallel
+	template<typename F>
+	auto gather(F f){
+		return onShards_([&f](Shard &shard){
+			return f(std::as_const(shard.store));
+		});
+	}
+
+	TDigestStore::Stats stats();
+
+	// per shard, empty without numa
+	std::vector<NodeArena::Placement> placement();
+
+private:
+	struct alignas(64) Shard{
+		int						node;
+		NodeArena					nodeArena;
+		std::pmr::unsynchronized_pool_resource		arena;
+		TDigestStore					store;
+
+		// producer count queues
+		std::vector<std::unique_ptr<SPSCRing<Sample> > >	queues;
+
+		std::vector<Sample>				batch;
+
+		alignas(64) std::atomic<bool>			posted	{ false };
+		std::mutex					mutex;
+		std::vector<std::function<void()> >		mailbox;
+
+		std::thread					thread;
+
+		Shard(double delta, AdaptiveSizing const &sizing, int node, bool numa) :
+					node(node),
+					nodeArena(node),
+					arena(numa ? &nodeArena : std::pmr::new_delete_resource()),
+					store(delta, sizing, &arena){}
+	};
+
+	// f(Shard &) on every shard, in parallel
+	template<typename F>
+	auto onShards_(F f){
+		using R = decltype(f(std::declval<Shard &>()));
+
+		std::vector<std::packaged_task<R()> > tasks;
+		tasks.reserve(shards_.size());
+
+		for(auto &shard : shards_){
+			tasks.emplace_back([&f, &shard]{
+				return f(*shard);
+			});
+
+			post_(*shard, [&task = tasks.back()]{
+				task();
+			});
+		}
+
+		std::vector<R> result;
+		result.reserve(tasks.size());
+
+		for(auto &task : tasks)
+			result.push_back(task.get_future().get());
+
+		return result;
+	}
+
+	template<typename F>
+	auto run_(size_t shard, F f){
+		using R = decltype(f(std::declval<TDigestStore const &>()));
+
+		auto &s = *shards_[shard];
+
+		std::packaged_task<R()> task{ [&f, &s]{
+			return f(std::as_const(s.store));
+		} };
+
+		auto future = task.get_future();
+
+		post_(s, [&task]{
+			task();
+		});
+
+		return future.get();
+	}
+
+	void post_(Shard &shard, std::function<void()> f);
+
+	void owner_(Shard &shard);
+
+private:
+	size_t					producers_;
+	ShardedConfig				config_;
+
+	std::vector<std::unique_ptr<Shard> >	shards_;
+
+	std::atomic<bool>			stop_	{ false };
+};
+
+
+
+// Producer handle, one per producer thread.
+// add() waits while the queue of the target shard is full.
+
+class ShardedTDigestStore::Producer{
+public:
+	Producer(ShardedTDigestStore &owner, size_t id) : owner_(&owner), id_(id){}
+
+	void add(std::string_view key, double value, uint64_t weight = 1);
+
+	// times add() waited for space
+	uint64_t stalls() const{
+		return stalls_;
+	}
+
+private:
+	ShardedTDigestStore	*owner_;
+	size_t			id_;
+	uint64_t		stalls_	= 0;
+};
+
+inline auto ShardedTDigestStore::producer(size_t id) -> Producer{
+	return Producer{ *this, id };
+}
+
+#endif
+
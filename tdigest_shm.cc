@@ -0,0 +1,380 @@
+#include "tdigest_shm.h"
+#include "tdigest_centroid.h"
+
+#include <new>
+#include <atomic>
+#include <limits>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+
+#include <pthread.h>
+#include <signal.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct SharedTDigestTable::Header{
+	constexpr static uint64_t MAGIC = 0x3274736567696474;	// "tdigest2"
+
+	uint64_t	magic;
+	uint64_t	slots;
+	uint64_t	capacity;
+	uint64_t	stride;
+	double		delta;
+	double		epsilon;
+};
+
+// blob follows the slot, on the next cache line
+struct alignas(64) SharedTDigestTable::Slot{
+	// state is EMPTY, READY or CLAIMING | pid of the claimer
+	enum : uint32_t{
+		EMPTY		= 0,
+		READY		= 1,
+		CLAIMING	= 1u << 31
+	};
+
+	pthread_mutex_t		mutex;		// robust, process shared
+	std::atomic<uint32_t>	state;
+	std::atomic<uint32_t>	seq;		// odd while writer is in
+	std::atomic<uint32_t>	recoveries;
+	uint32_t		keySize;
+	char			key[KEY_SIZE];
+};
+
+namespace{
+	constexpr size_t HEADER_SIZE = 64;
+
+	static_assert(std::atomic<uint32_t>::is_always_lock_free, "atomics in shared memory must be lock free");
+
+	constexpr size_t roundUp(size_t a, size_t b){
+		return (a + b - 1) / b * b;
+	}
+
+	uint64_t hash(std::string_view key){
+		// FNV-1a
+		uint64_t h = 0xcbf29ce484222325;
+
+		for(auto c : key){
+			h ^= static_cast<unsigned char>(c);
+			h *= 0x100000001b3;
+		}
+
+		return h;
+	}
+
+	void cpuRelax(){
+	#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+	#endif
+	}
+
+	// spins between the checks for dead process
+	constexpr size_t DEAD_CHECK = 1024;
+
+	bool alive(pid_t pid){
+		return kill(pid, 0) == 0 || errno != ESRCH;
+	}
+}
+
+SharedTDigestTable SharedTDigestTable::create(size_t slots, size_t capacity, double delta, const char *name){
+	static_assert(sizeof(Header) <= HEADER_SIZE);
+
+	if (!slots || capacity < 2)
+		return { nullptr, 0, RawTDigest{ 2, delta } };
+
+	RawTDigest const td{ capacity, delta };
+
+	auto const stride = sizeof(Slot) + roundUp(td.bytes(), 64);
+	auto const size   = HEADER_SIZE + slots * stride;
+
+	int const fd = name ?
+			shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600) :
+			memfd_create("tdigest", MFD_CLOEXEC);
+
+	if (fd < 0)
+		return { nullptr, 0, td };
+
+	void *mem = MAP_FAILED;
+
+	if (ftruncate(fd, static_cast<off_t>(size)) == 0)
+		mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	close(fd);
+
+	if (mem == MAP_FAILED){
+		if (name)
+			shm_unlink(name);
+
+		return { nullptr, 0, td };
+	}
+
+	// slot_() needs the stride, magic goes last - open() checks it
+	auto *header = static_cast<Header *>(mem);
+
+	header->slots		= slots;
+	header->capacity	= capacity;
+	header->stride		= stride;
+	header->delta		= delta;
+	header->epsilon		= td.epsilon();
+
+	SharedTDigestTable table{ mem, size, td };
+
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+
+	for(size_t i = 0; i < slots; ++i){
+		auto *slot = new(&table.slot_(i)) Slot;
+
+		pthread_mutex_init(&slot->mutex, &attr);
+
+		slot->state.store(Slot::EMPTY, std::memory_order_relaxed);
+		slot->seq.store(0, std::memory_order_relaxed);
+		slot->recoveries.store(0, std::memory_order_relaxed);
+		slot->keySize = 0;
+
+		td.clearFast(table.data_(i));
+	}
+
+	pthread_mutexattr_destroy(&attr);
+
+	std::atomic_thread_fence(std::memory_order_release);
+
+	header->magic		= Header::MAGIC;
+
+	return table;
+}
+
+SharedTDigestTable SharedTDigestTable::open(const char *name){
+	RawTDigest const empty{ 2, 0 };
+
+	int const fd = shm_open(name, O_RDWR, 0);
+
+	if (fd < 0)
+		return { nullptr, 0, empty };
+
+	struct stat st;
+
+	void *mem = MAP_FAILED;
+	size_t size = 0;
+
+	if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= HEADER_SIZE){
+		size = static_cast<size_t>(st.st_size);
+		mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+
+	close(fd);
+
+	if (mem == MAP_FAILED)
+		return { nullptr, 0, empty };
+
+	auto const &header = *static_cast<const Header *>(mem);
+
+	if (header.magic != Header::MAGIC || !header.slots || header.capacity < 2 || header.stride < sizeof(Slot) || HEADER_SIZE + header.slots * header.stride > size){
+		munmap(mem, size);
+		return { nullptr, 0, empty };
+	}
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	return { mem, size, RawTDigest{ header.capacity, header.delta, header.epsilon } };
+}
+
+bool SharedTDigestTable::unlink(const char *name){
+	return shm_unlink(name) == 0;
+}
+
+SharedTDigestTable::~SharedTDigestTable(){
+	if (mem_)
+		munmap(mem_, size_);
+}
+
+auto SharedTDigestTable::header_() const -> Header const &{
+	return *static_cast<const Header *>(mem_);
+}
+
+size_t SharedTDigestTable::slots() const{
+	return mem_ ? header_().slots : 0;
+}
+
+auto SharedTDigestTable::slot_(size_t slot) const -> Slot &{
+	auto *p = static_cast<char *>(mem_) + HEADER_SIZE + slot * header_().stride;
+
+	return *reinterpret_cast<Slot *>(p);
+}
+
+auto SharedTDigestTable::data_(size_t slot) const -> Centroid *{
+	return reinterpret_cast<Centroid *>(&slot_(slot) + 1);
+}
+
+uint32_t SharedTDigestTable::settle_(size_t slot) const{
+	auto &s = slot_(slot);
+
+	for(size_t spins = 1;; ++spins){
+		auto state = s.state.load(std::memory_order_acquire);
+
+		if (state == Slot::EMPTY || state == Slot::READY)
+			return state;
+
+		// claimer died between the claim and READY
+		if (spins % DEAD_CHECK == 0 && !alive(static_cast<pid_t>(state & ~Slot::CLAIMING)))
+			s.state.compare_exchange_strong(state, Slot::EMPTY, std::memory_order_acq_rel);
+
+		cpuRelax();
+	}
+}
+
+size_t SharedTDigestTable::slot(std::string_view key){
+	if (!mem_ || key.size() > KEY_SIZE)
+		return NO_SLOT;
+
+	auto const slots = header_().slots;
+	auto const start = hash(key) % slots;
+	auto const claim = Slot::CLAIMING | static_cast<uint32_t>(getpid());
+
+	for(size_t n = 0; n < slots; ++n){
+		auto const i = (start + n) % slots;
+		auto &s = slot_(i);
+
+		// other process is claiming it, may be the same key
+		for(auto state = settle_(i); state == Slot::EMPTY; state = settle_(i)){
+			if (s.state.compare_exchange_strong(state, claim, std::memory_order_acquire)){
+				s.keySize = static_cast<uint32_t>(key.size());
+				memcpy(s.key, key.data(), key.size());
+
+				s.state.store(Slot::READY, std::memory_order_release);
+
+				return i;
+			}
+		}
+
+		if (std::string_view{ s.key, s.keySize } == key)
+			return i;
+	}
+
+	return NO_SLOT;
+}
+
+size_t SharedTDigestTable::find(std::string_view key) const{
+	if (!mem_ || key.size() > KEY_SIZE)
+		return NO_SLOT;
+
+	auto const slots = header_().slots;
+	auto const start = hash(key) % slots;
+
+	for(size_t n = 0; n < slots; ++n){
+		auto const i = (start + n) % slots;
+		auto &s = slot_(i);
+
+		if (settle_(i) == Slot::EMPTY)
+			return NO_SLOT;
+
+		if (std::string_view{ s.key, s.keySize } == key)
+			return i;
+	}
+
+	return NO_SLOT;
+}
+
+void SharedTDigestTable::lock_(size_t slot) const{
+	auto &s = slot_(slot);
+
+	if (pthread_mutex_lock(&s.mutex) == EOWNERDEAD)
+		recover_(slot);
+
+	s.seq.store(s.seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+	// readers must not see the blob changes before the odd seq
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+void SharedTDigestTable::unlock_(size_t slot) const{
+	auto &s = slot_(slot);
+
+	s.seq.store(s.seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+
+	pthread_mutex_unlock(&s.mutex);
+}
+
+void SharedTDigestTable::recover_(size_t slot) const{
+	auto &s = slot_(slot);
+
+	auto const seq = s.seq.load(std::memory_order_relaxed);
+
+	// odd - the owner died in the middle of update
+	if (seq & 1){
+		td_.clear(data_(slot));
+
+		s.recoveries.fetch_add(1, std::memory_order_relaxed);
+		s.seq.store(seq + 1, std::memory_order_release);
+	}
+
+	pthread_mutex_consistent(&s.mutex);
+}
+
+void SharedTDigestTable::repair_(size_t slot) const{
+	auto &s = slot_(slot);
+
+	switch(pthread_mutex_trylock(&s.mutex)){
+	case EOWNERDEAD:
+		recover_(slot);
+		[[fallthrough]];
+
+	case 0:
+		pthread_mutex_unlock(&s.mutex);
+		break;
+
+	default:
+		// owner is alive
+		break;
+	}
+}
+
+bool SharedTDigestTable::snapshot(size_t slot, void *dest) const{
+	if (slot >= slots())
+		return false;
+
+	auto const &seq = slot_(slot).seq;
+	auto const *src = data_(slot);
+
+	for(size_t spins = 1;; ++spins){
+		auto const s1 = seq.load(std::memory_order_acquire);
+
+		if (s1 & 1){
+			if (spins % DEAD_CHECK == 0)
+				repair_(slot);
+
+			cpuRelax();
+			continue;
+		}
+
+		td_.store(src, dest);
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		if (seq.load(std::memory_order_relaxed) == s1)
+			return true;
+	}
+}
+
+double SharedTDigestTable::percentile(size_t slot, double p) const{
+	// per thread, no allocation per query
+	thread_local std::vector<Centroid> buffer;
+
+	if (buffer.size() < td_.capacity())
+		buffer.resize(td_.capacity());
+
+	if (!snapshot(slot, buffer.data()))
+		return std::numeric_limits<double>::quiet_NaN();
+
+	return td_.percentile(buffer.data(), p);
+}
+
+uint32_t SharedTDigestTable::recoveries(size_t slot) const{
+	return slot < slots() ? slot_(slot).recoveries.load(std::memory_order_relaxed) : 0;
+}
@@ -0,0 +1,135 @@
+#ifndef T_DIGEST_SHM_H_
+#define T_DIGEST_SHM_H_
+
+#include "tdigest.h"
+
+#include <cstdint>
+#include <string_view>
+#include <utility>	// exchange
+
+// Table of digests in shared memory, for pre-fork multi-process servers.
+//
+// create() before fork() - children inherit the mapping,
+// or create() with name and open() it from another process.
+//
+// each slot has seqlock - writers take robust process shared mutex and
+// update in place, readers copy consistent snapshot without blocking them.
+// keys are claimed once and never removed.
+//
+// process that dies in the middle of update leaves the blob half written,
+// next writer or reader clears the digest and counts it in recoveries().
+// slot claimed by process that died is freed by the next one that needs it.
+
+class SharedTDigestTable{
+public:
+	using Centroid		= RawTDigest::Centroid;
+	using Compression	= RawTDigest::Compression;
+
+	constexpr static size_t KEY_SIZE	= 48;
+	constexpr static size_t NO_SLOT		= static_cast<size_t>(-1);
+
+public:
+	// name == nullptr - anonymous memfd, shared with the children only
+	static SharedTDigestTable create(size_t slots, size_t capacity, double delta, const char *name = nullptr);
+
+	static SharedTDigestTable open(const char *name);
+
+	// unlinks the name, mappings stay valid
+	static bool unlink(const char *name);
+
+	SharedTDigestTable(SharedTDigestTable &&other) noexcept :
+					mem_	(std::exchange(other.mem_, nullptr)),
+					size_	(std::exchange(other.size_, 0)),
+					td_	(other.td_){}
+
+	SharedTDigestTable &operator=(SharedTDigestTable &&other) noexcept{
+		std::swap(mem_,  other.mem_ );
+		std::swap(size_, other.size_);
+		std::swap(td_,   other.td_  );
+		return *this;
+	}
+
+	~SharedTDigestTable();
+
+	bool valid() const{
+		return mem_;
+	}
+
+	RawTDigest const &raw() const{
+		return td_;
+	}
+
+	size_t slots() const;
+
+public:
+	// finds or claims slot for the key, NO_SLOT if the table is full
+	size_t slot(std::string_view key);
+
+	size_t find(std::string_view key) const;
+
+	// f(RawTDigest const &, Centroid *) under the slot lock,
+	// false for NO_SLOT
+	template<typename F>
+	bool update(size_t slot, F f){
+		if (slot >= slots())
+			return false;
+
+		lock_(slot);
+		f(td_, data_(slot));
+		unlock_(slot);
+
+		return true;
+	}
+
+	template<Compression C = Compression::AGGRESSIVE>
+	bool add(size_t slot, double value, uint64_t weight = 1){
+		return update(slot, [&](RawTDigest const &td, Centroid *cd){
+			td.add<C>(cd, value, weight);
+		});
+	}
+
+	// consistent copy of the blob, td.bytes() big, false for NO_SLOT
+	bool snapshot(size_t slot, void *dest) const;
+
+	// NaN for NO_SLOT
+	double percentile(size_t slot, double p) const;
+
+	// digests cleared after a writer died holding the lock
+	uint32_t recoveries(size_t slot) const;
+
+private:
+	SharedTDigestTable(void *mem, size_t size, RawTDigest const &td) :
+					mem_(mem),
+					size_(size),
+					td_(td){}
+
+	struct Header;
+	struct Slot;
+
+	Header const &header_() const;
+
+	Slot &slot_(size_t slot) const;
+
+	Centroid *data_(size_t slot) const;
+
+	// EMPTY or READY, frees slot claimed by process that died
+	uint32_t settle_(size_t slot) const;
+
+	void lock_(size_t slot) const;
+
+	void unlock_(size_t slot) const;
+
+	// under the lock, after the owner died
+	void recover_(size_t slot) const;
+
+	// for readers, recovers the lock if the owner died
+	void repair_(size_t slot) const;
+
+private:
+	void		*mem_;
+	size_t		size_;
+	RawTDigest	td_;
+};
+
+#endif
+
@@ -0,0 +1,421 @@
+#include "tdigest_snapshot.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace{
+	constexpr char	MAGIC[4]{ 'T', 'D', 'S', '1' };
+
+	uint32_t checksum(const char *data, size_t size, uint32_t hash = 2166136261u){
+		// FNV-1a
+		for(size_t i = 0; i < size; ++i){
+			hash ^= static_cast<unsigned char>(data[i]);
+			hash *= 16777619u;
+		}
+
+		return hash;
+	}
+
+	template<typename T>
+	void put(std::string &s, T const &value){
+		s.append(reinterpret_cast<const char *>(&value), sizeof(T));
+	}
+
+	template<typename T>
+	bool get(const char *&p, const char *last, T &value){
+		if (static_cast<size_t>(last - p) < sizeof(T))
+			return false;
+
+		memcpy(&value, p, sizeof(T));
+		p += sizeof(T);
+
+		return true;
+	}
+
+	bool get(const char *&p, const char *last, std::string_view &s, size_t size){
+		if (static_cast<size_t>(last - p) < size)
+			return false;
+
+		s = { p, size };
+		p += size;
+
+		return true;
+	}
+
+	bool writeAll(int fd, const char *data, size_t size){
+		while(size){
+			auto const n = write(fd, data, size);
+
+			if (n < 0)
+				return false;
+
+			data += n;
+			size -= static_cast<size_t>(n);
+		}
+
+		return true;
+	}
+
+	bool syncDir(std::string const &dir){
+		int const fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+		if (fd < 0)
+			return false;
+
+		bool const ok = fsync(fd) == 0;
+
+		close(fd);
+
+		return ok;
+	}
+
+	enum class Read{
+		OK,
+		MISSING,
+		ERROR
+	};
+
+	Read readFile(std::string const &path, std::string &data){
+		int const fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+		if (fd < 0)
+			return errno == ENOENT ? Read::MISSING : Read::ERROR;
+
+		struct stat st;
+
+		if (fstat(fd, &st) < 0){
+			close(fd);
+			return Read::ERROR;
+		}
+
+		data.resize(static_cast<size_t>(st.st_size));
+
+		size_t done = 0;
+
+		while(done < data.size()){
+			auto const n = read(fd, data.data() + done, data.size() - done);
+
+			if (n <= 0)
+				break;
+
+			done += static_cast<size_t>(n);
+		}
+
+		close(fd);
+
+		return done == data.size() ? Read::OK : Read::ERROR;
+	}
+
+	// f(key, capacity, blob) -> bool, capacity 0 for erased key.
+	// missing file is empty snapshot
+	template<typename F>
+	bool readSnapshot(std::string const &path, double delta, uint64_t &sequence, uint64_t &bytes, F f){
+		std::string data;
+
+		switch(readFile(path, data)){
+		case Read::MISSING:	bytes = 0;	return true;
+		case Read::ERROR:			return false;
+		case Read::OK:				break;
+		}
+
+		bytes = data.size();
+
+		if (data.size() < sizeof MAGIC + sizeof(uint32_t))
+			return false;
+
+		const char *p		= data.data();
+		const char *last	= data.data() + data.size() - sizeof(uint32_t);
+
+		uint32_t sum;
+		memcpy(&sum, last, sizeof sum);
+
+		if (memcmp(p, MAGIC, sizeof MAGIC) != 0 || checksum(p, static_cast<size_t>(last - p)) != sum)
+			return false;
+
+		p += sizeof MAGIC;
+
+		double   fileDelta;
+		uint64_t count;
+
+		if (!get(p, last, sequence) || !get(p, last, fileDelta) || !get(p, last, count) || fileDelta != delta)
+			return false;
+
+		for(uint64_t i = 0; i < count; ++i){
+			uint16_t	keySize;
+			uint64_t	capacity;
+			uint64_t	blobSize;
+
+			std::string_view key;
+			std::string_view blob;
+
+			if (!get(p, last, keySize) || !get(p, last, key, keySize) || !get(p, last, capacity) || !get(p, last, blobSize) || !get(p, last, blob, blobSize))
+				return false;
+
+			if (!f(key, capacity, blob))
+				return false;
+		}
+
+		return p == last;
+	}
+
+	bool apply(TDigestStore &store, std::string_view key, uint64_t capacity, std::string_view blob){
+		if (!capacity){
+			store.erase(key);
+			return true;
+		}
+
+		auto &digest = store.get(key);
+
+		digest.resize(capacity);
+
+		if (digest.bytes() != blob.size())
+			return false;
+
+		digest.load(blob.data());
+
+		return true;
+	}
+} // anonymous namespace
+
+
+
+std::string TDigestSnapshots::fullPath_() const{
+	return dir_ + "/full";
+}
+
+std::string TDigestSnapshots::incrementalPath_(uint64_t sequence) const{
+	char name[32];
+	snprintf(name, sizeof name, "/incr.%016llx", (unsigned long long) sequence);
+
+	return dir_ + name;
+}
+
+bool TDigestSnapshots::open(TDigestStore &store){
+	if (mkdir(dir_.c_str(), 0755) < 0 && errno != EEXIST)
+		return false;
+
+	delta_ = store.delta();
+
+	auto f = [&store](std::string_view key, uint64_t capacity, std::string_view blob){
+		return apply(store, key, capacity, blob);
+	};
+
+	fullSequence_ = 0;
+
+	if (!readSnapshot(fullPath_(), delta_, fullSequence_, fullBytes_, f))
+		return false;
+
+	std::vector<uint64_t> sequences;
+
+	auto *d = opendir(dir_.c_str());
+
+	if (!d)
+		return false;
+
+	while(auto *e = readdir(d)){
+		unsigned long long sequence;
+		int n = 0;
+
+		if (sscanf(e->d_name, "incr.%16llx%n", &sequence, &n) == 1 && e->d_name[n] == '\0')
+			sequences.push_back(sequence);
+	}
+
+	closedir(d);
+
+	std::sort(sequences.begin(), sequences.end());
+
+	sequence_		= fullSequence_;
+	incrementals_		= 0;
+	incrementalBytes_	= 0;
+
+	for(auto const s : sequences){
+		auto const path = incrementalPath_(s);
+
+		if (s <= fullSequence_){
+			// already in the full snapshot
+			unlink(path.c_str());
+			continue;
+		}
+
+		uint64_t sequence;
+		uint64_t bytes;
+
+		if (!readSnapshot(path, delta_, sequence, bytes, f) || sequence != s)
+			return false;
+
+		sequence_ = s;
+
+		++incrementals_;
+		incrementalBytes_ += bytes;
+	}
+
+	// everything loaded is on disk already,
+	// erases from now on must reach the next capture
+	since_ = store.advance() + 1;
+	store.forgetErased(since_);
+	store.trackErased(true);
+
+	return true;
+}
+
+auto TDigestSnapshots::capture(TDigestStore &store) -> Capture{
+	Capture capture;
+
+	// tombstones before the last written snapshot are on disk
+	store.forgetErased(since_);
+
+	auto const version = store.advance();
+
+	store.forEachChanged(since_, [&](std::string const &key, TDigestStore::Digest const *digest){
+		put(capture.data, static_cast<uint16_t>(key.size()));
+		capture.data.append(key);
+
+		if (!digest){
+			put(capture.data, uint64_t{ 0 });
+			put(capture.data, uint64_t{ 0 });
+
+			++capture.erased;
+		}else{
+			put(capture.data, static_cast<uint64_t>(digest->capacity()));
+			put(capture.data, static_cast<uint64_t>(digest->bytes()));
+
+			auto const start = capture.data.size();
+			capture.data.resize(start + digest->bytes());
+			digest->store(capture.data.data() + start);
+		}
+
+		++capture.keys;
+	});
+
+	capture.since = version + 1;
+
+	return capture;
+}
+
+bool TDigestSnapshots::writeFile_(std::string const &path, uint64_t sequence, uint64_t keys, std::string const &data) const{
+	std::string header{ MAGIC, sizeof MAGIC };
+
+	put(header, sequence);
+	put(header, delta_);
+	put(header, keys);
+
+	uint32_t const sum = checksum(data.data(), data.size(), checksum(header.data(), header.size()));
+
+	auto const temp = path + ".tmp";
+
+	int const fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+	if (fd < 0)
+		return false;
+
+	bool const ok =	writeAll(fd, header.data(), header.size())	&&
+			writeAll(fd, data.data(), data.size())		&&
+			writeAll(fd, reinterpret_cast<const char *>(&sum), sizeof sum) &&
+			fsync(fd) == 0;
+
+	close(fd);
+
+	if (!ok || rename(temp.c_str(), path.c_str()) < 0){
+		unlink(temp.c_str());
+		return false;
+	}
+
+	return syncDir(dir_);
+}
+
+bool TDigestSnapshots::write(Capture const &capture){
+	if (!capture.keys){
+		since_ = std::max(since_, capture.since);
+		return true;
+	}
+
+	auto const sequence = sequence_ + 1;
+
+	// on failure, next capture takes the changes again
+	if (!writeFile_(incrementalPath_(sequence), sequence, capture.keys, capture.data))
+		return false;
+
+	since_		= std::max(since_, capture.since);
+	sequence_	= sequence;
+
+	stats_.keys	+= capture.keys - capture.erased;
+	stats_.erased	+= capture.erased;
+
+	++incrementals_;
+	incrementalBytes_ += capture.data.size();
+
+	++stats_.incrementals;
+	stats_.bytes += capture.data.size();
+
+	if (incrementals_ >= config_.compactFiles || static_cast<double>(incrementalBytes_) >= config_.compactRatio * static_cast<double>(fullBytes_))
+		return compact();
+
+	return true;
+}
+
+bool TDigestSnapshots::compact(){
+	if (sequence_ == fullSequence_)
+		return true;
+
+	struct Entry{
+		uint64_t	capacity;
+		std::string	blob;
+	};
+
+	std::unordered_map<std::string, Entry> entries;
+
+	auto f = [&entries](std::string_view key, uint64_t capacity, std::string_view blob){
+		if (capacity)
+			entries[std::string{ key }] = { capacity, std::string{ blob } };
+		else
+			entries.erase(std::string{ key });
+
+		return true;
+	};
+
+	uint64_t sequence;
+	uint64_t bytes;
+
+	if (!readSnapshot(fullPath_(), delta_, sequence, bytes, f))
+		return false;
+
+	for(auto s = fullSequence_ + 1; s <= sequence_; ++s)
+		if (!readSnapshot(incrementalPath_(s), delta_, sequence, bytes, f))
+			return false;
+
+	std::string data;
+
+	for(auto const &[key, entry] : entries){
+		put(data, static_cast<uint16_t>(key.size()));
+		data.append(key);
+		put(data, entry.capacity);
+		put(data, static_cast<uint64_t>(entry.blob.size()));
+		data.append(entry.blob);
+	}
+
+	if (!writeFile_(fullPath_(), sequence_, entries.size(), data))
+		return false;
+
+	for(auto s = fullSequence_ + 1; s <= sequence_; ++s)
+		unlink(incrementalPath_(s).c_str());
+
+	fullSequence_		= sequence_;
+	fullBytes_		= data.size();
+	incrementals_		= 0;
+	incrementalBytes_	= 0;
+
+	++stats_.compactions;
+
+	return true;
+}
+
@@ -0,0 +1,91 @@
+#ifndef T_DIGEST_SNAPSHOT_H_
+#define T_DIGEST_SNAPSHOT_H_
+
+#include "tdigest_store.h"
+
+#include <cstdint>
+#include <string>
+
+// Incremental snapshots of the store.
+//
+// capture() takes the blobs of keys changed since the last written
+// capture, under the store lock, write() puts them to incr.<sequence> file.
+// when there are compactFiles incrementals, or they are bigger than
+// compactRatio of the full snapshot, compact() merges them into it -
+// from the files, the store is not touched.
+//
+// not thread safe, one snapshot writer.
+
+struct SnapshotConfig{
+	size_t		compactFiles	= 16;
+	double		compactRatio	= 0.5;
+};
+
+class TDigestSnapshots{
+public:
+	struct Capture{
+		uint64_t	keys	= 0;
+		uint64_t	erased	= 0;
+		uint64_t	since	= 0;	// store version, once written
+		std::string	data;	// records
+	};
+
+	struct Stats{
+		uint64_t	keys		= 0;	// written blobs
+		uint64_t	erased		= 0;
+		uint64_t	bytes		= 0;
+		uint64_t	incrementals	= 0;
+		uint64_t	compactions	= 0;
+	};
+
+public:
+	TDigestSnapshots(std::string dir, SnapshotConfig const &config = {}) :
+					dir_(std::move(dir)),
+					config_(config){}
+
+	// loads full snapshot and incrementals into the store and turns on
+	// its tombstones, call it first.
+	// false on I/O error, corrupted file or different delta
+	bool open(TDigestStore &store);
+
+	// under the store lock
+	Capture capture(TDigestStore &store);
+
+	// outside of the lock, compacts when due
+	bool write(Capture const &capture);
+
+	bool write(TDigestStore &store){
+		return write(capture(store));
+	}
+
+	bool compact();
+
+	Stats const &stats() const{
+		return stats_;
+	}
+
+private:
+	std::string fullPath_() const;
+
+	std::string incrementalPath_(uint64_t sequence) const;
+
+	bool writeFile_(std::string const &path, uint64_t sequence, uint64_t keys, std::string const &data) const;
+
+private:
+	std::string		dir_;
+	SnapshotConfig		config_;
+
+	double			delta_		= 0;
+	uint64_t		since_		= 0;	// store version
+
+	uint64_t		sequence_	= 0;	// last written
+	uint64_t		fullSequence_	= 0;
+	uint64_t		fullBytes_	= 0;
+	uint64_t		incrementals_	= 0;	// since compaction
+	uint64_t		incrementalBytes_	= 0;
+
+	Stats			stats_;
+};
+
+#endif
+
@@ -0,0 +1,132 @@
+#include "tdigest_store.h"
+
+#include <algorithm>
+#include <vector>
+
+auto TDigestStore::getSlot_(std::string_view key) -> Slot &{
+	if (auto it = map_.find(key); it != map_.end())
+		return it->second;
+
+	if (auto it = erased_.find(key); it != erased_.end())
+		erased_.erase(it);
+
+	auto [it, _] = map_.emplace(key, Slot{ Digest{ sizing_.initialCapacity, delta_, 0.0, allocator_ } });
+
+	it->second.version = version_;
+
+	return it->second;
+}
+
+void TDigestStore::add(Sample *samples, size_t count){
+	// stable keeps the order of weighted values
+	std::stable_sort(samples, samples + count, [](Sample const &a, Sample const &b){
+		return a.key < b.key;
+	});
+
+	std::vector<double> values;
+	values.reserve(count);
+
+	for(auto it = samples, last = samples + count; it != last;){
+		auto &slot = getSlot_(it->key);
+
+		slot.version = version_;
+
+		values.clear();
+
+		for(auto const &key = it->key; it != last && it->key == key; ++it){
+			if (it->weight == 1){
+				values.push_back(it->value);
+			}else{
+				slot.digest.add(it->value, it->weight);
+				++slot.adds;
+			}
+		}
+
+		if (!values.empty()){
+			slot.digest.add(values.data(), values.size());
+			slot.adds += values.size();
+		}
+	}
+}
+
+auto TDigestStore::find(std::string_view key) const -> const Digest *{
+	auto it = map_.find(key);
+
+	return it != map_.end() ? &it->second.digest : nullptr;
+}
+
+bool TDigestStore::erase(std::string_view key){
+	auto it = map_.find(key);
+
+	if (it == map_.end())
+		return false;
+
+	if (trackErased_)
+		erased_[it->first] = version_;
+
+	map_.erase(it);
+
+	return true;
+}
+
+void TDigestStore::forgetErased(uint64_t version){
+	for(auto it = erased_.begin(); it != erased_.end();){
+		if (it->second < version)
+			it = erased_.erase(it);
+		else
+			++it;
+	}
+}
+
+unsigned TDigestStore::idle(std::string_view key) const{
+	auto it = map_.find(key);
+
+	return it != map_.end() ? it->second.idle : 0;
+}
+
+auto TDigestStore::tick() -> Stats{
+	Stats stats;
+
+	for(auto &[key, slot] : map_){
+		auto &digest = slot.digest;
+
+		if (slot.adds){
+			slot.idle = 0;
+
+			bool const full = digest.size() == digest.capacity();
+
+			if (full && slot.adds >= sizing_.growAdds && digest.capacity() < sizing_.maxCapacity){
+				digest.resize(std::min(digest.capacity() * 2, sizing_.maxCapacity));
+				slot.version = version_;
+				++stats.grown;
+			}
+		}else if (++slot.idle >= sizing_.idleTicks){
+			slot.idle = 0;
+
+			if (digest.capacity() > sizing_.minCapacity){
+				digest.resize(std::max(digest.capacity() / 2, sizing_.minCapacity));
+				slot.version = version_;
+				++stats.shrunk;
+			}
+		}
+
+		slot.adds = 0;
+
+		++stats.keys;
+		stats.bytes += digest.bytes();
+	}
+
+	return stats;
+}
+
+auto TDigestStore::stats() const -> Stats{
+	Stats stats;
+
+	for(auto const &[key, slot] : map_){
+		++stats.keys;
+		stats.bytes += slot.digest.bytes();
+	}
+
+	return stats;
+}
+
@@ -0,0 +1,193 @@
+#ifndef T_DIGEST_STORE_H_
+#define T_DIGEST_STORE_H_
+
+#include "tdigest_owner.h"
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Adaptive per key capacity.
+// on each tick(), key that is full and took at least growAdds values
+// doubles its capacity, key that took nothing for idleTicks ticks
+// halves it, by compressing.
+
+struct AdaptiveSizing{
+	size_t		initialCapacity	= 16;
+	size_t		minCapacity	= 8;
+	size_t		maxCapacity	= 1024;
+	uint64_t	growAdds	= 1024;
+	unsigned	idleTicks	= 4;
+};
+
+// Keyed digest store.
+//
+// dirty tracking - each change stamps the slot with current version,
+// advance() closes the interval. add(), get() and update() that reports
+// a change count as change, reads do not. with trackErased(), erased
+// keys are kept as tombstones until forgetErased() - off by default,
+// nothing would forget them.
+
+class TDigestStore{
+public:
+	using Digest		= TDigest<>;
+	using allocator_type	= Digest::allocator_type;
+
+	struct Sample{
+		std::string	key;
+		double		value;
+		uint64_t	weight	= 1;
+	};
+
+	struct Stats{
+		size_t	keys		= 0;
+		size_t	bytes		= 0;
+		size_t	grown		= 0;
+		size_t	shrunk		= 0;
+	};
+
+public:
+	TDigestStore(double delta, AdaptiveSizing const &sizing = {}, allocator_type const &allocator = {}) :
+					delta_(delta),
+					sizing_(sizing),
+					allocator_(allocator){}
+
+	void add(std::string_view key, double value, uint64_t weight = 1){
+		auto &slot = getSlot_(key);
+
+		slot.digest.add(value, weight);
+		++slot.adds;
+		slot.version = version_;
+	}
+
+	// values are sorted in place
+	void add(std::string_view key, double *values, size_t count){
+		auto &slot = getSlot_(key);
+
+		slot.digest.add(values, count);
+		slot.adds += count;
+		slot.version = version_;
+	}
+
+	// grouped by key, samples are reordered
+	void add(Sample *samples, size_t count);
+
+	Digest &get(std::string_view key){
+		auto &slot = getSlot_(key);
+
+		slot.version = version_;
+
+		return slot.digest;
+	}
+
+	const Digest *find(std::string_view key) const;
+
+	// f(Digest &) returns true if it changed the digest, only then
+	// the slot is stamped. false if the key is not there or no change
+	template<typename F>
+	bool update(std::string_view key, F f){
+		auto it = map_.find(key);
+
+		if (it == map_.end() || !f(it->second.digest))
+			return false;
+
+		it->second.version = version_;
+
+		return true;
+	}
+
+	// ticks without adds, 0 if the key is not there
+	unsigned idle(std::string_view key) const;
+
+	bool erase(std::string_view key);
+
+	size_t size() const{
+		return map_.size();
+	}
+
+	double delta() const{
+		return delta_;
+	}
+
+	template<typename F>
+	void forEach(F f) const{
+		for(auto const &[key, slot] : map_)
+			f(key, slot.digest);
+	}
+
+	uint64_t version() const{
+		return version_;
+	}
+
+	// closes the interval, returns its version
+	uint64_t advance(){
+		return version_++;
+	}
+
+	// f(key, const Digest *) for keys changed in versions since..current,
+	// nullptr for erased key
+	template<typename F>
+	void forEachChanged(uint64_t since, F f) const{
+		for(auto const &[key, version] : erased_)
+			if (version >= since)
+				f(key, nullptr);
+
+		for(auto const &[key, slot] : map_)
+			if (slot.version >= since)
+				f(key, &slot.digest);
+	}
+
+	// on - erase() keeps tombstones for forEachChanged(),
+	// off - drops them
+	void trackErased(bool on){
+		trackErased_ = on;
+
+		if (!on)
+			erased_.clear();
+	}
+
+	// drops tombstones older than version
+	void forgetErased(uint64_t version);
+
+	// apply the adaptive sizing
+	Stats tick();
+
+	Stats stats() const;
+
+private:
+	// lookup by string_view, without building the key
+	struct Hash{
+		using is_transparent = void;
+
+		size_t operator()(std::string_view key) const{
+			return std::hash<std::string_view>{}(key);
+		}
+	};
+
+	template<typename T>
+	using Map = std::unordered_map<std::string, T, Hash, std::equal_to<>>;
+
+	struct Slot{
+		Digest		digest;
+		uint64_t	adds	= 0;	// values since the last tick
+		uint64_t	version	= 0;
+		unsigned	idle	= 0;
+	};
+
+	Slot &getSlot_(std::string_view key);
+
+private:
+	double					delta_;
+	AdaptiveSizing				sizing_;
+	allocator_type				allocator_;
+
+	Map<Slot>				map_;
+
+	uint64_t				version_	= 1;
+	bool					trackErased_	= false;
+	Map<uint64_t>				erased_;
+};
+
+#endif
+
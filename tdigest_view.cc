@@ -0,0 +1,85 @@
+#include "tdigest_view.h"
+#include "tdigest_centroid.h"
+
+#include <numeric>
+#include <queue>
+
+void MergedView::add(RawTDigest const &td, const Centroid *cd){
+	auto const size = td.size(cd);
+
+	if (size == 0)
+		return;
+
+	sources_.push_back({ cd, size });
+	weight_ += td.weight(cd);
+}
+
+double MergedView::cdf(double value) const{
+	if (weight_ == 0)
+		return 0;
+
+	uint64_t weight = 0;
+
+	for(auto const &s : sources_){
+		auto const last = std::upper_bound(s.cd, s.cd + s.size, Centroid::create(value, 1));
+
+		for(auto it = s.cd; it != last; ++it)
+			weight += it->getWeight();
+	}
+
+	return static_cast<double>(weight) / static_cast<double>(weight_);
+}
+
+void MergedView::percentile_(const double *pp, size_t count, double *out) const{
+	if (weight_ == 0)
+		return std::fill(out, out + count, 0.0);
+
+	std::vector<size_t> order(count);
+	std::iota(std::begin(order), std::end(order), size_t{ 0 });
+	std::sort(std::begin(order), std::end(order), [pp](size_t a, size_t b){
+		return pp[a] < pp[b];
+	});
+
+	// cursor into each source, smallest mean on top
+	struct Cursor{
+		const Centroid	*it;
+		const Centroid	*end;
+
+		bool operator<(Cursor const &other) const{
+			return *other.it < *it;
+		}
+	};
+
+	std::priority_queue<Cursor> heap;
+
+	for(auto const &s : sources_)
+		heap.push({ s.cd, s.cd + s.size });
+
+	uint64_t cumulativeWeight = 0;
+	size_t   next = 0;
+
+	while(next < count){
+		auto c = heap.top();
+		heap.pop();
+
+		auto const &x = *c.it;
+
+		cumulativeWeight += x.getWeight();
+
+		// the last centroid is the answer for everything left
+		bool const isLast = heap.empty() && c.it + 1 == c.end;
+
+		while(next < count){
+			auto const targetRank = pp[order[next]] * static_cast<double>(weight_);
+
+			if (!isLast && static_cast<double>(cumulativeWeight) < targetRank)
+				break;
+
+			out[order[next++]] = x.getMean();
+		}
+
+		if (++c.it != c.end)
+			heap.push(c);
+	}
+}
+
@@ -0,0 +1,86 @@
+#ifndef T_DIGEST_VIEW_H_
+#define T_DIGEST_VIEW_H_
+
+#include "tdigest.h"
+
+#include <cstdint>
+#include <cassert>
+#include <vector>
+#include <algorithm>	// copy
+
+// Read only view over many digests, queried as if they were merged.
+// percentile walks k-way streaming merge over the centroid arrays,
+// no merged buffer is built and nothing is compressed.
+//
+// the arrays are not copied, they must outlive the view and stay unchanged.
+
+class MergedView{
+public:
+	using Centroid = RawTDigest::Centroid;
+
+public:
+	MergedView() = default;
+
+	MergedView(RawTDigest const &td, const Centroid *const *cds, size_t count){
+		for(size_t i = 0; i < count; ++i)
+			add(td, cds[i]);
+	}
+
+	void add(RawTDigest const &td, const Centroid *cd);
+
+	size_t sources() const{
+		return sources_.size();
+	}
+
+	uint64_t weight() const{
+		return weight_;
+	}
+
+	double percentile_50() const{
+		return percentile(0.50);
+	}
+
+	double percentile_95() const{
+		return percentile(0.95);
+	}
+
+	double percentile(double const p) const{
+		assert(p >= 0.00 && p <= 1.00);
+
+		double result;
+		percentile_(&p, 1, &result);
+
+		return result;
+	}
+
+	// all percentiles are found in single merge pass
+	template<typename IT, typename OutIT>
+	void percentile(IT first, IT last, OutIT out) const{
+		std::vector<double> const pp(first, last);
+		std::vector<double>       oo(pp.size());
+
+		percentile_(pp.data(), pp.size(), oo.data());
+
+		std::copy(std::begin(oo), std::end(oo), out);
+	}
+
+	// fraction of the weight in centroids with mean <= value,
+	// upper_bound per source, then the weights below it are summed,
+	// linear in the centroids, but no merge.
+	double cdf(double value) const;
+
+private:
+	void percentile_(const double *pp, size_t count, double *out) const;
+
+private:
+	struct Source{
+		const Centroid	*cd;
+		size_t		size;
+	};
+
+	std::vector<Source>	sources_;
+	uint64_t		weight_ = 0;
+};
+
+#endif
+
@@ -0,0 +1,633 @@
+#include "tdigest_wal.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace{
+	constexpr char		CHECKPOINT_MAGIC[4]{ 'T', 'D', 'C', '1' };
+	constexpr size_t	HEADER_SIZE	= 2 * sizeof(uint32_t);
+	constexpr size_t	REPLAY_BATCH	= 1 << 16;
+
+	uint32_t checksum(const char *data, size_t size, uint32_t hash = 2166136261u){
+		// FNV-1a
+		for(size_t i = 0; i < size; ++i){
+			hash ^= static_cast<unsigned char>(data[i]);
+			hash *= 16777619u;
+		}
+
+		return hash;
+	}
+
+	template<typename T>
+	void put(std::string &s, T const &value){
+		s.append(reinterpret_cast<const char *>(&value), sizeof(T));
+	}
+
+	template<typename T>
+	bool get(const char *&p, const char *last, T &value){
+		if (static_cast<size_t>(last - p) < sizeof(T))
+			return false;
+
+		memcpy(&value, p, sizeof(T));
+		p += sizeof(T);
+
+		return true;
+	}
+
+	bool get(const char *&p, const char *last, std::string_view &s, size_t size){
+		if (static_cast<size_t>(last - p) < size)
+			return false;
+
+		s = { p, size };
+		p += size;
+
+		return true;
+	}
+
+	bool writeAll(int fd, const char *data, size_t size){
+		while(size){
+			auto const n = write(fd, data, size);
+
+			if (n < 0)
+				return false;
+
+			data += n;
+			size -= static_cast<size_t>(n);
+		}
+
+		return true;
+	}
+
+	bool readAll(int fd, char *data, size_t size){
+		while(size){
+			auto const n = read(fd, data, size);
+
+			if (n <= 0)
+				return false;
+
+			data += n;
+			size -= static_cast<size_t>(n);
+		}
+
+		return true;
+	}
+
+	bool syncDir(std::string const &dir){
+		int const fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+		if (fd < 0)
+			return false;
+
+		bool const ok = fsync(fd) == 0;
+
+		close(fd);
+
+		return ok;
+	}
+
+	// decodes record body, values go to buffer
+	bool decode(const char *p, const char *last, TDigestWAL::Record &record, std::vector<double> &buffer){
+		using Type = TDigestWAL::Type;
+
+		uint8_t  type;
+		uint16_t keySize;
+
+		if (!get(p, last, type) || !get(p, last, keySize) || !get(p, last, record.key, keySize))
+			return false;
+
+		record.type = static_cast<Type>(type);
+
+		switch(record.type){
+		case Type::ADD:
+			return get(p, last, record.value) && get(p, last, record.weight) && p == last;
+
+		case Type::ADD_MANY:{
+			uint64_t count;
+
+			auto const size = static_cast<size_t>(last - p) - sizeof count;
+
+			if (!get(p, last, count) || count != size / sizeof(double) || size % sizeof(double))
+				return false;
+
+			// body is not aligned
+			buffer.resize(count);
+			memcpy(buffer.data(), p, count * sizeof(double));
+
+			record.values	= buffer.data();
+			record.count	= count;
+
+			return true;
+		}
+
+		case Type::MERGE:{
+			uint16_t srcSize;
+
+			return get(p, last, srcSize) && get(p, last, record.src, srcSize) && p == last;
+		}
+
+		default:
+			return false;
+		}
+	}
+} // anonymous namespace
+
+
+
+TDigestWAL::~TDigestWAL(){
+	if (fd_ >= 0){
+		commit();
+		close(fd_);
+	}
+}
+
+bool TDigestWAL::open(std::string const &path){
+	assert(fd_ < 0);
+
+	fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+	return fd_ >= 0;
+}
+
+bool TDigestWAL::reopen(std::string const &path){
+	std::unique_lock lock{ mutex_ };
+
+	while(syncing_)
+		synced_.wait(lock);
+
+	if (failed_ || (!buffer_.empty() && !flush_(lock)))
+		return false;
+
+	// flush_() unlocks, others may start sync meanwhile
+	while(syncing_)
+		synced_.wait(lock);
+
+	close(fd_);
+	fd_ = -1;
+
+	return open(path);
+}
+
+uint64_t TDigestWAL::append(Record const &record){
+	assert(record.key.size() <= UINT16_MAX && record.src.size() <= UINT16_MAX);
+
+	std::lock_guard lock{ mutex_ };
+
+	// nothing would ever write it
+	if (failed_)
+		return 0;
+
+	auto const start = buffer_.size();
+
+	// header is patched below
+	buffer_.append(HEADER_SIZE, '\0');
+
+	put(buffer_, static_cast<uint8_t>(record.type));
+	put(buffer_, static_cast<uint16_t>(record.key.size()));
+	buffer_.append(record.key);
+
+	switch(record.type){
+	case Type::ADD:
+		put(buffer_, record.value);
+		put(buffer_, record.weight);
+		break;
+
+	case Type::ADD_MANY:
+		put(buffer_, static_cast<uint64_t>(record.count));
+		buffer_.append(reinterpret_cast<const char *>(record.values), record.count * sizeof(double));
+		break;
+
+	case Type::MERGE:
+		put(buffer_, static_cast<uint16_t>(record.src.size()));
+		buffer_.append(record.src);
+		break;
+	}
+
+	auto const body = buffer_.data() + start + HEADER_SIZE;
+	auto const size = static_cast<uint32_t>(buffer_.size() - start - HEADER_SIZE);
+
+	uint32_t const header[2]{ size, checksum(body, size) };
+
+	memcpy(buffer_.data() + start, header, HEADER_SIZE);
+
+	++stats_.records;
+
+	return ++lsn_;
+}
+
+bool TDigestWAL::commit(uint64_t lsn){
+	std::unique_lock lock{ mutex_ };
+
+	// someone else is writing, our record may be in that batch
+	while(syncing_ && durable_ < lsn && !failed_)
+		synced_.wait(lock);
+
+	if (failed_ || fd_ < 0)
+		return false;
+
+	if (durable_ >= lsn)
+		return true;
+
+	return flush_(lock);
+}
+
+bool TDigestWAL::flush_(std::unique_lock<std::mutex> &lock){
+	syncing_ = true;
+
+	std::string batch;
+	batch.swap(buffer_);
+
+	auto const lsn	= lsn_;
+	auto const fd	= fd_;
+
+	lock.unlock();
+
+	bool const ok = writeAll(fd, batch.data(), batch.size()) && fdatasync(fd) == 0;
+
+	lock.lock();
+
+	syncing_ = false;
+
+	if (ok){
+		durable_ = lsn;
+
+		++stats_.syncs;
+		stats_.bytes += batch.size();
+	}else{
+		failed_ = true;
+		buffer_.clear();
+	}
+
+	// keep the allocation
+	if (buffer_.empty()){
+		batch.clear();
+		buffer_.swap(batch);
+	}
+
+	synced_.notify_all();
+
+	return ok;
+}
+
+bool TDigestWAL::replay(std::string const &path, std::function<void(Record const &)> const &f){
+	int const fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+
+	if (fd < 0)
+		return errno == ENOENT;
+
+	struct stat st;
+
+	if (fstat(fd, &st) < 0){
+		close(fd);
+		return false;
+	}
+
+	auto const fileSize = static_cast<size_t>(st.st_size);
+
+	// read in large blocks, records may cross them
+	constexpr size_t BLOCK = 1 << 20;
+
+	std::vector<char>	buffer;
+	std::vector<double>	values;
+
+	size_t	offset	= 0;	// file offset of buffer[0]
+	size_t	pos	= 0;	// valid records end
+	bool	ok	= true;
+
+	auto fill = [&](size_t need){
+		// keep the unparsed tail
+		buffer.erase(buffer.begin(), buffer.begin() + static_cast<ptrdiff_t>(pos - offset));
+		offset = pos;
+
+		auto const have = buffer.size();
+		auto const size = std::min(std::max(need, BLOCK), fileSize - offset - have);
+
+		if (have + size < need)
+			return false;
+
+		buffer.resize(have + size);
+
+		if (!readAll(fd, buffer.data() + have, size)){
+			ok = false;
+			return false;
+		}
+
+		return true;
+	};
+
+	for(;;){
+		if (pos + HEADER_SIZE > offset + buffer.size() && !fill(HEADER_SIZE))
+			break;
+
+		uint32_t header[2];
+		memcpy(header, buffer.data() + (pos - offset), HEADER_SIZE);
+
+		size_t const total = HEADER_SIZE + header[0];
+
+		if (pos + total > offset + buffer.size() && !fill(total))
+			break;
+
+		auto const body = buffer.data() + (pos - offset) + HEADER_SIZE;
+
+		Record record{};
+
+		if (checksum(body, header[0]) != header[1] || !decode(body, body + header[0], record, values))
+			break;
+
+		f(record);
+
+		pos += total;
+	}
+
+	// torn tail
+	if (ok && pos < fileSize)
+		ok = ftruncate(fd, static_cast<off_t>(pos)) == 0 && fsync(fd) == 0;
+
+	close(fd);
+
+	return ok;
+}
+
+
+
+std::string DurableTDigestStore::walPath_(uint64_t generation) const{
+	char name[32];
+	snprintf(name, sizeof name, "/wal.%016llx", (unsigned long long) generation);
+
+	return dir_ + name;
+}
+
+std::string DurableTDigestStore::checkpointPath_() const{
+	return dir_ + "/checkpoint";
+}
+
+bool DurableTDigestStore::loadCheckpoint_(uint64_t &generation){
+	generation = 0;
+
+	int const fd = ::open(checkpointPath_().c_str(), O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return errno == ENOENT;
+
+	struct stat st;
+
+	std::string data;
+
+	bool const ok = fstat(fd, &st) == 0 && (data.resize(static_cast<size_t>(st.st_size)), readAll(fd, data.data(), data.size()));
+
+	close(fd);
+
+	if (!ok || data.size() < sizeof CHECKPOINT_MAGIC + sizeof(uint32_t))
+		return false;
+
+	const char *p		= data.data();
+	const char *last	= data.data() + data.size() - sizeof(uint32_t);
+
+	uint32_t sum;
+	memcpy(&sum, last, sizeof sum);
+
+	if (memcmp(p, CHECKPOINT_MAGIC, sizeof CHECKPOINT_MAGIC) != 0 || checksum(p, static_cast<size_t>(last - p)) != sum)
+		return false;
+
+	p += sizeof CHECKPOINT_MAGIC;
+
+	double   delta;
+	uint64_t count;
+
+	if (!get(p, last, generation) || !get(p, last, delta) || !get(p, last, count) || delta != delta_)
+		return false;
+
+	for(uint64_t i = 0; i < count; ++i){
+		uint16_t	keySize;
+		uint64_t	capacity;
+
+		std::string_view key;
+		std::string_view blob;
+
+		if (!get(p, last, keySize) || !get(p, last, key, keySize) || !get(p, last, capacity))
+			return false;
+
+		auto &digest = store_.get(key);
+
+		digest.resize(capacity);
+
+		if (!get(p, last, blob, digest.bytes()))
+			return false;
+
+		digest.load(blob.data());
+	}
+
+	return p == last;
+}
+
+bool DurableTDigestStore::open(){
+	if (mkdir(dir_.c_str(), 0755) < 0 && errno != EEXIST)
+		return false;
+
+	std::lock_guard lock{ mutex_ };
+
+	uint64_t generation;
+
+	if (!loadCheckpoint_(generation))
+		return false;
+
+	std::vector<uint64_t> generations;
+
+	if (auto *d = opendir(dir_.c_str()); d){
+		while(auto *e = readdir(d)){
+			unsigned long long g;
+			int n = 0;
+
+			if (sscanf(e->d_name, "wal.%16llx%n", &g, &n) == 1 && e->d_name[n] == '\0')
+				generations.push_back(g);
+		}
+
+		closedir(d);
+	}else{
+		return false;
+	}
+
+	std::sort(generations.begin(), generations.end());
+
+	// single adds are batched, the rest applies them first
+	std::vector<TDigestStore::Sample> batch;
+
+	// record values are const, add() sorts them
+	std::vector<double> values;
+
+	auto apply = [&](){
+		store_.add(batch.data(), batch.size());
+		batch.clear();
+	};
+
+	auto f = [&](TDigestWAL::Record const &record){
+		using Type = TDigestWAL::Type;
+
+		switch(record.type){
+		case Type::ADD:
+			batch.push_back({ std::string{ record.key }, record.value, record.weight });
+			break;
+
+		case Type::ADD_MANY:
+			apply();
+
+			values.assign(record.values, record.values + record.count);
+			store_.add(record.key, values.data(), values.size());
+
+			break;
+
+		case Type::MERGE:
+			apply();
+
+			if (auto const *src = store_.find(record.src); src && record.src != record.key)
+				store_.get(record.key).merge(*src);
+
+			break;
+		}
+
+		if (batch.size() >= REPLAY_BATCH)
+			apply();
+
+		++replayed_;
+	};
+
+	for(auto const g : generations){
+		if (g < generation){
+			// already in the checkpoint
+			unlink(walPath_(g).c_str());
+			continue;
+		}
+
+		if (!TDigestWAL::replay(walPath_(g), f))
+			return false;
+
+		generation = g;
+	}
+
+	apply();
+
+	generation_ = generation;
+
+	return wal_.open(walPath_(generation_)) && syncDir(dir_);
+}
+
+uint64_t DurableTDigestStore::add(std::string_view key, double value, uint64_t weight){
+	std::lock_guard lock{ mutex_ };
+
+	store_.add(key, value, weight);
+
+	TDigestWAL::Record record{ TDigestWAL::Type::ADD, key };
+	record.value	= value;
+	record.weight	= weight;
+
+	return wal_.append(record);
+}
+
+uint64_t DurableTDigestStore::add(std::string_view key, double *values, size_t count){
+	std::lock_guard lock{ mutex_ };
+
+	TDigestWAL::Record record{ TDigestWAL::Type::ADD_MANY, key };
+	record.values	= values;
+	record.count	= count;
+
+	// log before values are sorted
+	auto const lsn = wal_.append(record);
+
+	store_.add(key, values, count);
+
+	return lsn;
+}
+
+uint64_t DurableTDigestStore::merge(std::string_view dest, std::string_view src){
+	std::lock_guard lock{ mutex_ };
+
+	auto const *digest = store_.find(src);
+
+	if (!digest)
+		return 0;
+
+	if (dest != src)
+		store_.get(dest).merge(*digest);
+
+	TDigestWAL::Record record{ TDigestWAL::Type::MERGE, dest };
+	record.src = src;
+
+	return wal_.append(record);
+}
+
+bool DurableTDigestStore::checkpoint(){
+	std::lock_guard checkpointLock{ checkpointMutex_ };
+
+	std::string data{ CHECKPOINT_MAGIC, sizeof CHECKPOINT_MAGIC };
+
+	uint64_t generation;
+
+	{
+		std::lock_guard lock{ mutex_ };
+
+		generation = generation_ + 1;
+
+		// everything logged before the switch is in the checkpoint
+		if (!wal_.reopen(walPath_(generation)))
+			return false;
+
+		generation_ = generation;
+
+		// new wal must be in the directory, before anything is committed to it
+		if (!syncDir(dir_))
+			return false;
+
+		put(data, generation);
+		put(data, delta_);
+		put(data, static_cast<uint64_t>(store_.size()));
+
+		store_.forEach([&](std::string const &key, Digest const &digest){
+			put(data, static_cast<uint16_t>(key.size()));
+			data.append(key);
+			put(data, static_cast<uint64_t>(digest.capacity()));
+
+			auto const start = data.size();
+			data.resize(start + digest.bytes());
+			digest.store(data.data() + start);
+		});
+	}
+
+	put(data, checksum(data.data(), data.size()));
+
+	auto const path = checkpointPath_();
+	auto const temp = path + ".tmp";
+
+	int const fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+	if (fd < 0)
+		return false;
+
+	bool const ok = writeAll(fd, data.data(), data.size()) && fsync(fd) == 0;
+
+	close(fd);
+
+	if (!ok || rename(temp.c_str(), path.c_str()) < 0 || !syncDir(dir_))
+		return false;
+
+	for(uint64_t g = generation; g-- > 0;)
+		if (unlink(walPath_(g).c_str()) < 0)
+			break;
+
+	return true;
+}
+
+auto DurableTDigestStore::stats() const -> Stats{
+	std::lock_guard lock{ mutex_ };
+
+	return { wal_.stats(), replayed_, generation_ };
+}
+
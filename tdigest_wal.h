@@ -0,0 +1,183 @@
+#ifndef T_DIGEST_WAL_H_
+#define T_DIGEST_WAL_H_
+
+#include "tdigest_store.h"
+
+#include <cstdint>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+// Write ahead log of store operations.
+//
+// records are appended to memory buffer, commit() writes and syncs it.
+// group commit - one thread writes and fdatasync()s the buffer for all
+// threads waiting on it, the rest wait for the next sync.
+//
+// record - size, checksum, type, key, payload.
+// torn record at the tail is cut off on replay.
+
+class TDigestWAL{
+public:
+	enum class Type : uint8_t{
+		ADD		= 1,
+		ADD_MANY	= 2,
+		MERGE		= 3
+	};
+
+	struct Record{
+		Type			type;
+		std::string_view	key;
+		std::string_view	src;		// MERGE
+		double			value	= 0;	// ADD
+		uint64_t		weight	= 1;	// ADD
+		const double		*values	= nullptr;	// ADD_MANY
+		size_t			count	= 0;	// ADD_MANY
+	};
+
+	struct Stats{
+		uint64_t	records		= 0;
+		uint64_t	syncs		= 0;
+		uint64_t	bytes		= 0;
+	};
+
+public:
+	TDigestWAL() = default;
+
+	TDigestWAL(TDigestWAL const &) = delete;
+	TDigestWAL &operator=(TDigestWAL const &) = delete;
+
+	~TDigestWAL();
+
+	// appends to the file, creates it if needed
+	bool open(std::string const &path);
+
+	// commits and closes the old file first
+	bool reopen(std::string const &path);
+
+	// lsn of the record,
+	// 0 once a write failed - the record is dropped
+	uint64_t append(Record const &record);
+
+	// waits until lsn is on disk
+	bool commit(uint64_t lsn);
+
+	bool commit(){
+		return commit(lsn());
+	}
+
+	uint64_t lsn() const{
+		std::lock_guard lock{ mutex_ };
+		return lsn_;
+	}
+
+	Stats stats() const{
+		std::lock_guard lock{ mutex_ };
+		return stats_;
+	}
+
+	// f(Record const &) for each valid record, torn tail is truncated.
+	// false on I/O error, missing file is empty log
+	static bool replay(std::string const &path, std::function<void(Record const &)> const &f);
+
+private:
+	bool flush_(std::unique_lock<std::mutex> &lock);
+
+private:
+	mutable std::mutex		mutex_;
+	std::condition_variable		synced_;
+
+	int				fd_		= -1;
+
+	std::string			buffer_;
+	uint64_t			lsn_		= 0;
+	uint64_t			durable_	= 0;
+	bool				syncing_	= false;
+	bool				failed_		= false;
+
+	Stats				stats_;
+};
+
+
+
+// Store with write ahead log and checkpoints.
+//
+// directory has checkpoint - all blobs, and wal.<generation> files.
+// checkpoint() switches to new wal generation and writes the blobs,
+// recovery loads the checkpoint and replays the wals from its generation,
+// batching the adds per key.
+//
+// replayed digest is equivalent, not the same bytes -
+// batch add compresses differently than the single adds did.
+// operations are thread safe, commit() outside of the store lock.
+
+class DurableTDigestStore{
+public:
+	using Digest = TDigestStore::Digest;
+
+	struct Stats{
+		TDigestWAL::Stats	wal;
+		uint64_t		replayed	= 0;	// records at open()
+		uint64_t		generation	= 0;
+	};
+
+public:
+	DurableTDigestStore(std::string dir, double delta, AdaptiveSizing const &sizing = {}) :
+					dir_(std::move(dir)),
+					delta_(delta),
+					store_(delta, sizing){}
+
+	// recovery, false on I/O error, corrupted checkpoint or different delta
+	bool open();
+
+	// lsn to commit(), 0 once the log failed - commit(0) is false then
+	uint64_t add(std::string_view key, double value, uint64_t weight = 1);
+
+	uint64_t add(std::string_view key, double *values, size_t count);
+
+	// 0 if src does not exist or the log failed
+	uint64_t merge(std::string_view dest, std::string_view src);
+
+	bool commit(uint64_t lsn){
+		return wal_.commit(lsn);
+	}
+
+	bool commit(){
+		return wal_.commit();
+	}
+
+	bool checkpoint();
+
+	// f(TDigestStore const &)
+	template<typename F>
+	auto read(F f) const{
+		std::lock_guard lock{ mutex_ };
+		return f(store_);
+	}
+
+	Stats stats() const;
+
+private:
+	std::string walPath_(uint64_t generation) const;
+
+	std::string checkpointPath_() const;
+
+	bool loadCheckpoint_(uint64_t &generation);
+
+private:
+	std::string		dir_;
+	double			delta_;
+
+	mutable std::mutex	mutex_;
+	std::mutex		checkpointMutex_;
+	TDigestStore		store_;
+	TDigestWAL		wal_;
+
+	uint64_t		generation_	= 0;
+	uint64_t		replayed_	= 0;
+};
+
+#endif
+
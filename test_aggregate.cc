@@ -0,0 +1,116 @@
+// test_aggregate - out of core aggregation, spilled to a scratch directory.
+//
+//	test_aggregate [directory]
+
+#include "tdigest_aggregate.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace{
+	int failed = 0;
+
+	void check(bool ok, const char *what){
+		if (!ok){
+			fprintf(stderr, "FAIL %s\n", what);
+			++failed;
+		}
+	}
+
+	constexpr size_t CAPACITY	= 100;
+	constexpr double DELTA		= 0.01;
+
+	constexpr size_t COUNT		= 100'000;
+	constexpr size_t CHUNK		= 1000;		// values
+	constexpr size_t PENDING	= 4;
+
+	// uniform over [0, 1), in no particular order
+	std::vector<double> values(){
+		std::vector<double> v(COUNT);
+
+		for(size_t i = 0; i < COUNT; ++i)
+			v[i] = std::fmod(static_cast<double>(i) * 0.6180339887498949, 1.0);
+
+		return v;
+	}
+
+	void checkResult(RawTDigest const &td, FileAggregator const &aggregator, const RawTDigest::Centroid *cd, const char *what){
+		std::string const s = what;
+
+		// many spill groups, finish() merges them pending at a time
+		check(aggregator.stats().spills > PENDING, (s + ": spills").c_str());
+		check(td.weight(cd) == COUNT, (s + ": weight").c_str());
+
+		for(double const p : { 0.05, 0.50, 0.95 })
+			check(std::abs(td.percentile(cd, p) - p) < 0.02, (s + ": percentile").c_str());
+	}
+
+	void testChunks(RawTDigest const &td, WorkStealingPool &pool, AggregateConfig const &config){
+		auto v = values();
+
+		FileAggregator aggregator{ td, pool, config };
+
+		for(size_t i = 0; i < COUNT; i += CHUNK)
+			check(aggregator.addChunk(v.data() + i, CHUNK), "chunks: add");
+
+		std::vector<char> blob(td.bytes());
+		auto *cd = reinterpret_cast<RawTDigest::Centroid *>(blob.data());
+
+		check(aggregator.finish(cd), "chunks: finish");
+
+		checkResult(td, aggregator, cd, "chunks");
+	}
+
+	void testFile(RawTDigest const &td, WorkStealingPool &pool, AggregateConfig const &config, std::string const &dir){
+		auto const v = values();
+
+		auto const path = dir + "/test_aggregate." + std::to_string(getpid());
+
+		int const fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		check(fd >= 0, "file: create");
+
+		auto const bytes = static_cast<ssize_t>(v.size() * sizeof(double));
+		check(write(fd, v.data(), v.size() * sizeof(double)) == bytes, "file: write");
+		close(fd);
+
+		FileAggregator aggregator{ td, pool, config };
+
+		check(aggregator.addFile(path.c_str()), "file: add");
+
+		unlink(path.c_str());
+
+		std::vector<char> blob(td.bytes());
+		auto *cd = reinterpret_cast<RawTDigest::Centroid *>(blob.data());
+
+		check(aggregator.finish(cd), "file: finish");
+		check(aggregator.stats().values == COUNT, "file: values");
+
+		checkResult(td, aggregator, cd, "file");
+	}
+} // anonymous namespace
+
+int main(int argc, char **argv){
+	std::string dir = argc > 1 ? argv[1] : "/tmp";
+
+	RawTDigest const td{ CAPACITY, DELTA };
+
+	WorkStealingPool pool{ 4 };
+
+	AggregateConfig config;
+	config.chunkBytes	= CHUNK * sizeof(double);
+	config.pending		= PENDING;
+	config.spillDir		= dir.c_str();
+
+	testChunks(td, pool, config);
+	testFile(td, pool, config, dir);
+
+	printf("test_aggregate: %s\n", failed ? "FAILED" : "OK");
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,265 @@
+// test_durability - write ahead log and snapshots, in a scratch directory.
+//
+//	test_durability [directory]
+
+#include "tdigest_wal.h"
+#include "tdigest_snapshot.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+namespace{
+	int failed = 0;
+
+	void check(bool ok, const char *what){
+		if (!ok){
+			fprintf(stderr, "FAIL %s\n", what);
+			++failed;
+		}
+	}
+
+	void removeAll(std::string const &path){
+		if (auto *d = opendir(path.c_str()); d){
+			while(auto *e = readdir(d)){
+				std::string const name = e->d_name;
+
+				if (name != "." && name != "..")
+					removeAll(path + "/" + name);
+			}
+
+			closedir(d);
+			rmdir(path.c_str());
+		}else{
+			unlink(path.c_str());
+		}
+	}
+
+	off_t fileSize(std::string const &path){
+		struct stat st;
+		return stat(path.c_str(), &st) == 0 ? st.st_size : -1;
+	}
+
+	bool exists(std::string const &path){
+		return fileSize(path) >= 0;
+	}
+
+	uint64_t weight(TDigestStore const &store, const char *key){
+		auto const *digest = store.find(key);
+		return digest ? digest->weight() : 0;
+	}
+
+	uint64_t weight(DurableTDigestStore const &durable, const char *key){
+		return durable.read([key](TDigestStore const &store){
+			return weight(store, key);
+		});
+	}
+
+	void testRecovery(std::string const &dir){
+		removeAll(dir);
+
+		// child dies without destructors, only committed records are kept
+		auto const pid = fork();
+
+		if (pid == 0){
+			DurableTDigestStore store{ dir, 0.1 };
+
+			if (!store.open())
+				_exit(1);
+
+			for(int i = 0; i < 1000; ++i)
+				store.add("a", i);
+
+			std::vector<double> values(500, 7.0);
+			store.add("b", values.data(), values.size());
+
+			store.checkpoint();
+
+			for(int i = 0; i < 100; ++i)
+				store.add("a", i);
+
+			store.merge("c", "b");
+
+			_exit(store.commit() ? 0 : 1);
+		}
+
+		int status;
+		waitpid(pid, &status, 0);
+
+		check(WIFEXITED(status) && WEXITSTATUS(status) == 0, "recovery: writer");
+
+		DurableTDigestStore store{ dir, 0.1 };
+
+		check(store.open(), "recovery: open");
+		check(weight(store, "a") == 1100, "recovery: adds across checkpoint");
+		check(weight(store, "b") == 500, "recovery: batch add");
+		check(weight(store, "c") == 500, "recovery: merge");
+		check(store.stats().generation == 1, "recovery: generation");
+		check(!exists(dir + "/wal.0000000000000000"), "recovery: old wal removed");
+
+		DurableTDigestStore other{ dir, 0.2 };
+
+		check(!other.open(), "recovery: different delta");
+	}
+
+	void testTornTail(std::string const &dir){
+		removeAll(dir);
+		mkdir(dir.c_str(), 0755);
+
+		auto const path = dir + "/wal";
+
+		{
+			TDigestWAL wal;
+
+			check(wal.open(path), "torn: open");
+
+			for(int i = 0; i < 10; ++i){
+				TDigestWAL::Record record{ TDigestWAL::Type::ADD, "k" };
+				record.value = i;
+
+				wal.append(record);
+			}
+
+			check(wal.commit(), "torn: commit");
+		}
+
+		auto const size = fileSize(path);
+
+		// half of the last record
+		check(truncate(path.c_str(), size - 8) == 0, "torn: truncate");
+
+		size_t records = 0;
+
+		check(TDigestWAL::replay(path, [&](TDigestWAL::Record const &){ ++records; }), "torn: replay");
+		check(records == 9, "torn: valid records");
+		check(fileSize(path) == size / 10 * 9, "torn: tail cut off");
+
+		// garbage after the valid records
+		int const fd = open(path.c_str(), O_WRONLY | O_APPEND);
+		check(write(fd, "garbage!garbage!", 16) == 16, "torn: garbage");
+		close(fd);
+
+		records = 0;
+
+		check(TDigestWAL::replay(path, [&](TDigestWAL::Record const &){ ++records; }), "torn: replay garbage");
+		check(records == 9, "torn: records after garbage");
+		check(fileSize(path) == size / 10 * 9, "torn: garbage cut off");
+	}
+
+	void testFailedWal(){
+		// every write fails with ENOSPC
+		TDigestWAL wal;
+
+		if (!wal.open("/dev/full"))
+			return;
+
+		TDigestWAL::Record record{ TDigestWAL::Type::ADD, "k" };
+
+		auto const lsn = wal.append(record);
+
+		check(lsn == 1, "failed wal: first lsn");
+		check(!wal.commit(lsn), "failed wal: commit");
+		check(wal.append(record) == 0, "failed wal: append after failure");
+		check(!wal.commit(0), "failed wal: commit after failure");
+	}
+
+	void testCompaction(std::string const &dir){
+		removeAll(dir);
+
+		SnapshotConfig config;
+		config.compactFiles	= 4;
+		config.compactRatio	= 1e9;
+
+		TDigestStore store{ 0.1 };
+		TDigestSnapshots snapshots{ dir, config };
+
+		check(snapshots.open(store), "compaction: open");
+
+		for(int i = 0; i < 10; ++i){
+			store.add("k" + std::to_string(i), i);
+			store.add("all", i);
+
+			if (i == 5)
+				store.erase("k0");
+
+			check(snapshots.write(store), "compaction: write");
+		}
+
+		// nothing changed, nothing written
+		check(snapshots.write(store), "compaction: empty write");
+
+		check(snapshots.stats().incrementals == 10, "compaction: incrementals");
+		// first write becomes the full snapshot, then every 4 incrementals
+		check(snapshots.stats().compactions == 3, "compaction: compactions");
+		check(snapshots.stats().erased == 1, "compaction: tombstone");
+		check(exists(dir + "/full"), "compaction: full");
+
+		TDigestStore loaded{ 0.1 };
+		TDigestSnapshots reopened{ dir, config };
+
+		check(reopened.open(loaded), "compaction: reopen");
+		check(loaded.size() == store.size(), "compaction: keys");
+		check(!loaded.find("k0"), "compaction: erased key");
+		check(weight(loaded, "all") == 10, "compaction: weight");
+		check(weight(loaded, "k9") == 1, "compaction: last incremental");
+	}
+
+	void testFailedSnapshot(std::string const &dir){
+		removeAll(dir);
+
+		TDigestStore store{ 0.1 };
+		TDigestSnapshots snapshots{ dir };
+
+		check(snapshots.open(store), "failed snapshot: open");
+
+		store.add("x", 1);
+		check(snapshots.write(store), "failed snapshot: first write");
+
+		store.add("b", 2);
+		store.erase("x");
+
+		// directory in place of the next incremental - rename fails
+		auto const blocker = dir + "/incr.0000000000000002";
+		mkdir(blocker.c_str(), 0755);
+
+		check(!snapshots.write(store), "failed snapshot: write fails");
+
+		rmdir(blocker.c_str());
+
+		check(snapshots.write(store), "failed snapshot: next write");
+
+		TDigestStore loaded{ 0.1 };
+		TDigestSnapshots reopened{ dir };
+
+		check(reopened.open(loaded), "failed snapshot: reopen");
+		check(loaded.find("b"), "failed snapshot: change kept");
+		check(!loaded.find("x"), "failed snapshot: tombstone kept");
+	}
+} // anonymous namespace
+
+int main(int argc, char **argv){
+	std::string dir = argc > 1 ? argv[1] : "/tmp";
+
+	dir += "/test_durability." + std::to_string(getpid());
+
+	mkdir(dir.c_str(), 0755);
+
+	testRecovery(dir + "/recovery");
+	testTornTail(dir + "/torn");
+	testFailedWal();
+	testCompaction(dir + "/compaction");
+	testFailedSnapshot(dir + "/failed");
+
+	removeAll(dir);
+
+	printf("test_durability: %s\n", failed ? "FAILED" : "OK");
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,188 @@
+// test_server - starts tdigest_server on unix socket and talks to it.
+//
+//	test_server [path to tdigest_server]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+namespace{
+	int failed = 0;
+
+	void check(bool ok, const char *what){
+		if (!ok){
+			fprintf(stderr, "FAIL %s\n", what);
+			++failed;
+		}
+	}
+
+	int connectTo(const char *path){
+		sockaddr_un addr{};
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, path, sizeof addr.sun_path - 1);
+
+		// server may not listen yet
+		for(int i = 0; i < 100; ++i){
+			int const fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+			if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) == 0)
+				return fd;
+
+			close(fd);
+			usleep(10000);
+		}
+
+		return -1;
+	}
+
+	bool sendAll(int fd, std::string const &s){
+		for(size_t done = 0; done < s.size();){
+			auto const n = send(fd, s.data() + done, s.size() - done, MSG_NOSIGNAL);
+
+			if (n <= 0)
+				return false;
+
+			done += static_cast<size_t>(n);
+		}
+
+		return true;
+	}
+
+	// reads until lines replies or eof
+	std::string receive(int fd, size_t lines){
+		std::string s;
+
+		for(size_t seen = 0; seen < lines;){
+			char buffer[4096];
+
+			auto const n = recv(fd, buffer, sizeof buffer, 0);
+
+			if (n <= 0)
+				break;
+
+			for(ssize_t i = 0; i < n; ++i)
+				seen += buffer[i] == '\n';
+
+			s.append(buffer, static_cast<size_t>(n));
+		}
+
+		return s;
+	}
+
+	std::string request(const char *path, std::string const &commands, size_t lines){
+		int const fd = connectTo(path);
+
+		if (fd < 0)
+			return "no connection";
+
+		sendAll(fd, commands);
+
+		auto s = receive(fd, lines);
+
+		close(fd);
+
+		return s;
+	}
+
+	void testPipelining(const char *path){
+		// single write, replies in order
+		std::string commands;
+		std::string expect;
+
+		for(int i = 1; i <= 1000; ++i){
+			commands += "ADD p " + std::to_string(i) + "\n";
+			expect   += "OK\n";
+		}
+
+		commands += "ADDMANY q 1 2 3\r\nPING\nQUANTILE q 0 1\n";
+		expect   += "OK 3\nPONG\n1 3\n";
+
+		check(request(path, commands, 1003) == expect, "pipelined replies");
+	}
+
+	void testErrors(const char *path){
+		auto const s = request(path,
+				"ADD\n"
+				"ADD k\n"
+				"ADD k x\n"
+				"ADD k nan\n"
+				"ADDMANY k 1 inf\n"
+				"ADD k 1 0\n"
+				"ADD k 1 2 junk\n"
+				"QUANTILE k 2\n"
+				"QUANTILE missing 0.5\n"
+				"MERGE k missing\n"
+				"FOO k\n"
+				"ADD k 5\n"
+				"QUANTILE k 0.5\n", 13);
+
+		check(s ==	"ERR missing key\n"
+				"ERR bad value\n"
+				"ERR bad value\n"
+				"ERR bad value\n"
+				"ERR bad value\n"
+				"ERR bad weight\n"
+				"ERR too many arguments\n"
+				"ERR bad quantile\n"
+				"ERR no such key\n"
+				"ERR no such key\n"
+				"ERR unknown command\n"
+				"OK\n"
+				"5\n", "error replies");
+	}
+
+	void testLongLine(const char *path){
+		int const fd = connectTo(path);
+
+		std::string const line(1 << 20, '1');
+
+		// server closes before all is sent
+		for(int i = 0; i < 8 && sendAll(fd, line); ++i){}
+
+		auto const s = receive(fd, 2);
+
+		check(s == "ERR line too long\n", "line without newline is closed");
+
+		close(fd);
+
+		// server is still fine
+		check(request(path, "PING\n", 1) == "PONG\n", "ping after long line");
+	}
+} // anonymous namespace
+
+int main(int argc, char **argv){
+	const char *server = argc > 1 ? argv[1] : "./tdigest_server";
+
+	char path[64];
+	snprintf(path, sizeof path, "/tmp/test_server.%d.sock", (int) getpid());
+
+	unlink(path);
+
+	auto const pid = fork();
+
+	if (pid == 0){
+		execl(server, server, "-u", path, nullptr);
+		_exit(127);
+	}
+
+	testPipelining(path);
+	testErrors(path);
+	testLongLine(path);
+
+	kill(pid, SIGTERM);
+	waitpid(pid, nullptr, 0);
+
+	unlink(path);
+
+	printf("test_server: %s\n", failed ? "FAILED" : "OK");
+
+	return failed ? 1 : 0;
+}
+
@@ -0,0 +1,131 @@
+#include "thread_pool.h"
+
+#include <algorithm>	// max
+
+namespace{
+	// worker of which pool is the current thread
+	thread_local const WorkStealingPool	*currentPool	= nullptr;
+	thread_local size_t			currentIndex	= 0;
+}
+
+WorkStealingPool::WorkStealingPool(size_t threads){
+	threads = std::max<size_t>(threads, 1);
+
+	queues_.reserve(threads);
+
+	for(size_t i = 0; i < threads; ++i)
+		queues_.push_back(std::make_unique<Queue>());
+
+	threads_.reserve(threads);
+
+	for(size_t i = 0; i < threads; ++i)
+		threads_.emplace_back(&WorkStealingPool::worker_, this, i);
+}
+
+WorkStealingPool::~WorkStealingPool(){
+	{
+		std::lock_guard lock{ idleMutex_ };
+		stop_ = true;
+	}
+
+	idle_.notify_all();
+
+	for(auto &t : threads_)
+		t.join();
+}
+
+void WorkStealingPool::submit(Task task){
+	auto const index = currentPool == this ?
+				currentIndex :
+				next_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+
+	// counted first, so it never goes below zero
+	queued_.fetch_add(1, std::memory_order_relaxed);
+
+	{
+		auto &q = *queues_[index];
+
+		std::lock_guard lock{ q.mutex };
+		q.tasks.push_back(std::move(task));
+	}
+
+	// sleeping worker checks queued_ under the mutex
+	{
+		std::lock_guard lock{ idleMutex_ };
+	}
+
+	idle_.notify_one();
+}
+
+bool WorkStealingPool::pop_(size_t index, Task &task){
+	auto &q = *queues_[index];
+
+	std::lock_guard lock{ q.mutex };
+
+	if (q.tasks.empty())
+		return false;
+
+	task = std::move(q.tasks.back());
+	q.tasks.pop_back();
+
+	return true;
+}
+
+bool WorkStealingPool::steal_(size_t index, Task &task){
+	auto const size = queues_.size();
+
+	for(size_t i = 1; i <= size; ++i){
+		auto &q = *queues_[(index + i) % size];
+
+		std::lock_guard lock{ q.mutex };
+
+		if (q.tasks.empty())
+			continue;
+
+		task = std::move(q.tasks.front());
+		q.tasks.pop_front();
+
+		steals_.fetch_add(1, std::memory_order_relaxed);
+
+		return true;
+	}
+
+	return false;
+}
+
+bool WorkStealingPool::runOne(){
+	if (queued_.load(std::memory_order_acquire) == 0)
+		return false;
+
+	Task task;
+
+	bool const worker = currentPool == this;
+
+	if ((worker && pop_(currentIndex, task)) || steal_(worker ? currentIndex : 0, task)){
+		queued_.fetch_sub(1, std::memory_order_relaxed);
+		task();
+		return true;
+	}
+
+	return false;
+}
+
+void WorkStealingPool::worker_(size_t index){
+	currentPool	= this;
+	currentIndex	= index;
+
+	for(;;){
+		if (runOne())
+			continue;
+
+		std::unique_lock lock{ idleMutex_ };
+
+		idle_.wait(lock, [this]{
+			return stop_ || queued_.load(std::memory_order_acquire);
+		});
+
+		if (stop_ && queued_.load(std::memory_order_acquire) == 0)
+			return;
+	}
+}
+
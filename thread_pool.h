@@ -0,0 +1,91 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work stealing thread pool.
+//
+// each worker has own deque - it takes its own tasks from the back,
+// idle worker steals from the front of the others.
+// task submitted from a worker goes to its own deque,
+// from outside - round robin.
+//
+// thread waiting in parallelFor() runs tasks too, so nested use is fine.
+
+class WorkStealingPool{
+public:
+	using Task = std::function<void()>;
+
+public:
+	explicit WorkStealingPool(size_t threads = std::thread::hardware_concurrency());
+
+	WorkStealingPool(WorkStealingPool const &) = delete;
+	WorkStealingPool &operator=(WorkStealingPool const &) = delete;
+
+	// runs the queued tasks first
+	~WorkStealingPool();
+
+	size_t threads() const{
+		return threads_.size();
+	}
+
+	void submit(Task task);
+
+	// runs single queued task, false if there is none
+	bool runOne();
+
+	// f(i) for i in [0, count), returns when all are done
+	template<typename F>
+	void parallelFor(size_t count, F f){
+		std::atomic<size_t> remaining{ count };
+
+		for(size_t i = 0; i < count; ++i){
+			submit([&f, &remaining, i]{
+				f(i);
+				remaining.fetch_sub(1, std::memory_order_release);
+			});
+		}
+
+		while(remaining.load(std::memory_order_acquire))
+			if (!runOne())
+				std::this_thread::yield();
+	}
+
+	uint64_t steals() const{
+		return steals_.load(std::memory_order_relaxed);
+	}
+
+private:
+	struct alignas(64) Queue{
+		std::mutex		mutex;
+		std::deque<Task>	tasks;
+	};
+
+	void worker_(size_t index);
+
+	bool pop_(size_t index, Task &task);
+
+	bool steal_(size_t index, Task &task);
+
+private:
+	std::vector<std::unique_ptr<Queue> >	queues_;
+	std::vector<std::thread>		threads_;
+
+	std::atomic<size_t>			next_		{ 0 };
+	std::atomic<size_t>			queued_		{ 0 };
+	std::atomic<uint64_t>			steals_		{ 0 };
+
+	std::mutex				idleMutex_;
+	std::condition_variable			idle_;
+	bool					stop_		= false;
+};
+
+#endif
+